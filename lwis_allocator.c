@@ -11,43 +11,36 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME "-allocator: " fmt
 
+#include <linux/irqflags.h>
 #include <linux/mm.h>
 #include <linux/mutex.h>
+#include <linux/overflow.h>
+#include <linux/percpu.h>
 #include <linux/preempt.h>
 #include <linux/slab.h>
+#include <linux/smp.h>
 #include "lwis_allocator.h"
 #include "lwis_commands.h"
 
 static void allocator_block_pool_free_locked(struct lwis_device *lwis_dev,
 					     struct lwis_allocator_block_pool *block_pool)
 {
-	struct lwis_allocator_block_mgr *block_mgr = lwis_dev->block_mgr;
-
 	if (block_pool == NULL) {
 		dev_err(lwis_dev->dev, "block_pool is NULL\n");
 		return;
 	}
-	if (block_pool->in_use_count != 0 || block_pool->in_use != NULL) {
+	if (block_pool->in_use_count != 0) {
 		dev_err(lwis_dev->dev, "block_pool %s still has %d block(s) in use\n",
 			block_pool->name, block_pool->in_use_count);
 	}
 
 	while (block_pool->free != NULL) {
 		struct lwis_allocator_block *curr;
-		struct lwis_allocator_block *block;
-		struct hlist_node *n;
-		int i;
 
 		curr = block_pool->free;
-		hash_for_each_safe (block_mgr->allocated_blocks, i, n, block, node) {
-			if (block->ptr == curr->ptr) {
-				hash_del(&block->node);
-			}
-		}
 		block_pool->free = curr->next;
 		block_pool->free_count--;
-		kvfree(curr->ptr);
-		kfree(curr);
+		kvfree(curr);
 	}
 }
 
@@ -66,16 +59,8 @@ allocator_free_block_get_locked(struct lwis_allocator_block_pool *block_pool)
 
 	head = block_pool->free;
 	block_pool->free = head->next;
-	if (block_pool->free != NULL) {
-		block_pool->free->prev = NULL;
-	}
 	block_pool->free_count--;
-
-	head->next = block_pool->in_use;
-	if (head->next != NULL) {
-		head->next->prev = head;
-	}
-	block_pool->in_use = head;
+	head->next = NULL;
 	block_pool->in_use_count++;
 
 	return head;
@@ -93,21 +78,8 @@ static void allocator_free_block_put_locked(struct lwis_allocator_block_pool *bl
 		return;
 	}
 
-	if (block->next != NULL) {
-		block->next->prev = block->prev;
-	}
-	if (block->prev != NULL) {
-		block->prev->next = block->next;
-	} else {
-		block_pool->in_use = block->next;
-	}
 	block_pool->in_use_count--;
-
-	if (block_pool->free != NULL) {
-		block_pool->free->prev = block;
-	}
 	block->next = block_pool->free;
-	block->prev = NULL;
 	block_pool->free = block;
 	block_pool->free_count++;
 }
@@ -147,9 +119,325 @@ allocator_get_block_pool(struct lwis_allocator_block_mgr *block_mgr, int idx)
 	return block_pool;
 }
 
+/* Number of blocks of pool idx a CPU may cache */
+static uint32_t allocator_magazine_size(int idx)
+{
+	return clamp_t(uint32_t, LWIS_ALLOCATOR_MAGAZINE_BYTES >> idx, 1,
+		       LWIS_ALLOCATOR_MAGAZINE_SIZE);
+}
+
+/* Number of blocks of pool idx moved at once between a CPU and the pool */
+static uint32_t allocator_magazine_batch(int idx)
+{
+	return max_t(uint32_t, allocator_magazine_size(idx) / 2, 1);
+}
+
+/* Calling this function requires local interrupts to be disabled */
+static struct lwis_allocator_magazine *
+allocator_magazine_get(struct lwis_allocator_block_mgr *block_mgr, int idx)
+{
+	return &this_cpu_ptr(block_mgr->cpu_cache)
+			->magazines[idx - LWIS_ALLOCATOR_MIN_POOL_IDX];
+}
+
+/* Calling this function requires local interrupts to be disabled.
+ * Moves up to a batch of free blocks of pool idx from the shared pool into
+ * the magazine. */
+static void allocator_magazine_refill(struct lwis_allocator_block_mgr *block_mgr,
+				      struct lwis_allocator_block_pool *block_pool,
+				      struct lwis_allocator_magazine *magazine, int idx)
+{
+	struct lwis_allocator_block *block;
+	uint32_t batch = allocator_magazine_batch(idx);
+
+	spin_lock(&block_mgr->lock);
+	while (magazine->count < batch) {
+		block = allocator_free_block_get_locked(block_pool);
+		if (block == NULL) {
+			break;
+		}
+		magazine->blocks[magazine->count++] = block;
+	}
+	spin_unlock(&block_mgr->lock);
+}
+
+/* Free blocks of pool idx cached by all CPUs, racy but only used as a hint */
+static uint32_t allocator_magazines_count(struct lwis_allocator_block_mgr *block_mgr, int idx)
+{
+	uint32_t count = 0;
+	int cpu;
+
+	for_each_possible_cpu (cpu) {
+		count += READ_ONCE(per_cpu_ptr(block_mgr->cpu_cache, cpu)
+					   ->magazines[idx - LWIS_ALLOCATOR_MIN_POOL_IDX]
+					   .count);
+	}
+	return count;
+}
+
+/* Calling this function requires local interrupts to be disabled, or the
+ * magazine not to be used by anyone else. Returns blocks from the magazine of
+ * pool idx to the shared pool until only keep_count blocks are left. */
+static void allocator_magazine_drain(struct lwis_allocator_block_mgr *block_mgr,
+				     struct lwis_allocator_block_pool *block_pool,
+				     struct lwis_allocator_magazine *magazine, int idx,
+				     uint32_t keep_count)
+{
+	spin_lock(&block_mgr->lock);
+	while (magazine->count > keep_count) {
+		allocator_free_block_put_locked(block_pool,
+						magazine->blocks[--magazine->count]);
+	}
+	if (block_pool->free_count + allocator_magazines_count(block_mgr, idx) >
+	    block_pool->high_watermark) {
+		schedule_work(&block_mgr->trim_work);
+	}
+	spin_unlock(&block_mgr->lock);
+}
+
+static void allocator_magazines_flush(struct lwis_allocator_block_mgr *block_mgr)
+{
+	struct lwis_allocator_cpu_cache *cpu_cache;
+	unsigned long flags;
+	int cpu, i;
+
+	local_irq_save(flags);
+	for_each_possible_cpu (cpu) {
+		cpu_cache = per_cpu_ptr(block_mgr->cpu_cache, cpu);
+		for (i = 0; i < LWIS_ALLOCATOR_NUM_POOLS; i++) {
+			allocator_magazine_drain(
+				block_mgr,
+				allocator_get_block_pool(block_mgr,
+							 i + LWIS_ALLOCATOR_MIN_POOL_IDX),
+				&cpu_cache->magazines[i], i + LWIS_ALLOCATOR_MIN_POOL_IDX, 0);
+		}
+	}
+	local_irq_restore(flags);
+}
+
+/* Drains the magazines of the CPU this runs on, called via on_each_cpu() */
+static void allocator_magazines_drain_local(void *data)
+{
+	struct lwis_allocator_block_mgr *block_mgr = data;
+	int idx;
+
+	for (idx = LWIS_ALLOCATOR_MIN_POOL_IDX; idx <= LWIS_ALLOCATOR_MAX_POOL_IDX; idx++) {
+		allocator_magazine_drain(block_mgr, allocator_get_block_pool(block_mgr, idx),
+					 allocator_magazine_get(block_mgr, idx), idx, 0);
+	}
+}
+
+/*
+ * Frees blocks from the pool free list until at most target_count blocks are
+ * left or max_count blocks are freed. The blocks are freed outside of the lock
+ * as kvfree() may sleep.
+ * Returns the number of blocks freed.
+ */
+static unsigned long allocator_block_pool_trim(struct lwis_allocator_block_mgr *block_mgr,
+					       struct lwis_allocator_block_pool *block_pool,
+					       uint32_t target_count, unsigned long max_count)
+{
+	struct lwis_allocator_block *trimmed = NULL;
+	struct lwis_allocator_block *block;
+	unsigned long freed = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&block_mgr->lock, flags);
+	while (block_pool->free != NULL && block_pool->free_count > target_count &&
+	       freed < max_count) {
+		block = block_pool->free;
+		block_pool->free = block->next;
+		block_pool->free_count--;
+		block->next = trimmed;
+		trimmed = block;
+		freed++;
+	}
+	spin_unlock_irqrestore(&block_mgr->lock, flags);
+
+	while (trimmed != NULL) {
+		block = trimmed;
+		trimmed = block->next;
+		kvfree(block);
+	}
+
+	return freed;
+}
+
+static void allocator_trim_work_func(struct work_struct *work)
+{
+	struct lwis_allocator_block_mgr *block_mgr =
+		container_of(work, struct lwis_allocator_block_mgr, trim_work);
+	struct lwis_allocator_block_pool *block_pool;
+	bool over[LWIS_ALLOCATOR_NUM_POOLS];
+	bool drain = false;
+	int idx;
+
+	/* Blocks cached by the CPUs count against the watermarks too */
+	for (idx = LWIS_ALLOCATOR_MIN_POOL_IDX; idx <= LWIS_ALLOCATOR_MAX_POOL_IDX; idx++) {
+		block_pool = allocator_get_block_pool(block_mgr, idx);
+		over[idx - LWIS_ALLOCATOR_MIN_POOL_IDX] =
+			READ_ONCE(block_pool->free_count) + allocator_magazines_count(block_mgr, idx) >
+			block_pool->high_watermark;
+		drain |= over[idx - LWIS_ALLOCATOR_MIN_POOL_IDX];
+	}
+	if (drain) {
+		on_each_cpu(allocator_magazines_drain_local, block_mgr, 1);
+	}
+
+	for (idx = LWIS_ALLOCATOR_MIN_POOL_IDX; idx <= LWIS_ALLOCATOR_MAX_POOL_IDX; idx++) {
+		if (over[idx - LWIS_ALLOCATOR_MIN_POOL_IDX]) {
+			block_pool = allocator_get_block_pool(block_mgr, idx);
+			allocator_block_pool_trim(block_mgr, block_pool, block_pool->low_watermark,
+						  ULONG_MAX);
+		}
+	}
+}
+
+static unsigned long allocator_shrink_count(struct shrinker *shrinker,
+					    struct shrink_control *sc)
+{
+	struct lwis_allocator_block_mgr *block_mgr =
+		container_of(shrinker, struct lwis_allocator_block_mgr, shrinker);
+	struct lwis_allocator_cpu_cache *cpu_cache;
+	unsigned long count = 0;
+	int cpu, idx;
+
+	/* Racy reads are fine, this is only an estimate for the shrinker */
+	for (idx = LWIS_ALLOCATOR_MIN_POOL_IDX; idx <= LWIS_ALLOCATOR_MAX_POOL_IDX; idx++) {
+		count += READ_ONCE(allocator_get_block_pool(block_mgr, idx)->free_count);
+	}
+	for_each_possible_cpu (cpu) {
+		cpu_cache = per_cpu_ptr(block_mgr->cpu_cache, cpu);
+		for (idx = 0; idx < LWIS_ALLOCATOR_NUM_POOLS; idx++) {
+			count += READ_ONCE(cpu_cache->magazines[idx].count);
+		}
+	}
+
+	return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long allocator_shrink_scan(struct shrinker *shrinker,
+					   struct shrink_control *sc)
+{
+	struct lwis_allocator_block_mgr *block_mgr =
+		container_of(shrinker, struct lwis_allocator_block_mgr, shrinker);
+	unsigned long freed = 0;
+	int idx;
+
+	/* Move the blocks cached by each CPU back to the pools first */
+	on_each_cpu(allocator_magazines_drain_local, block_mgr, 1);
+
+	/* Start from the largest blocks to give back the most memory */
+	for (idx = LWIS_ALLOCATOR_MAX_POOL_IDX; idx >= LWIS_ALLOCATOR_MIN_POOL_IDX; idx--) {
+		freed += allocator_block_pool_trim(block_mgr,
+						   allocator_get_block_pool(block_mgr, idx),
+						   /*target_count=*/0, sc->nr_to_scan - freed);
+		if (freed >= sc->nr_to_scan) {
+			break;
+		}
+	}
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+/* Fills the pool free list up to num_blocks blocks */
+static int allocator_block_pool_fill(struct lwis_device *lwis_dev,
+				     struct lwis_allocator_block_mgr *block_mgr, int idx,
+				     uint32_t num_blocks)
+{
+	struct lwis_allocator_block_pool *block_pool;
+	struct lwis_allocator_block *block;
+	unsigned long flags;
+	uint32_t count;
+
+	block_pool = allocator_get_block_pool(block_mgr, idx);
+	if (block_pool == NULL) {
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&block_mgr->lock, flags);
+	count = block_pool->free_count;
+	spin_unlock_irqrestore(&block_mgr->lock, flags);
+
+	for (; count < num_blocks; count++) {
+		block = kvmalloc(1 << idx, GFP_KERNEL);
+		if (block == NULL) {
+			dev_err(lwis_dev->dev, "Reserve %s block failed\n", block_pool->name);
+			return -ENOMEM;
+		}
+		block->type = idx;
+
+		spin_lock_irqsave(&block_mgr->lock, flags);
+		block->next = block_pool->free;
+		block_pool->free = block;
+		block_pool->free_count++;
+		spin_unlock_irqrestore(&block_mgr->lock, flags);
+	}
+
+	return 0;
+}
+
+/*
+ * Sets the pool watermarks from the number of blocks reserved by the device
+ * tree and the clients of lwis_dev, so that reserved blocks are not trimmed
+ * and the reservations of released clients are given back.
+ * Calling this requires holding lwis_dev->client_lock.
+ */
+static void allocator_update_reservations_locked(struct lwis_device *lwis_dev,
+						 struct lwis_allocator_block_mgr *block_mgr)
+{
+	uint32_t reserved[LWIS_ALLOCATOR_NUM_POOLS];
+	struct lwis_allocator_block_pool *block_pool;
+	struct lwis_client *client;
+	bool needs_trim = false;
+	unsigned long flags;
+	int i, idx;
+
+	memcpy(reserved, lwis_dev->allocator_reserve_blocks, sizeof(reserved));
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	list_for_each_entry (client, &lwis_dev->clients, node) {
+		for (i = 0; i < LWIS_ALLOCATOR_NUM_POOLS; i++) {
+			reserved[i] = max(reserved[i], client->allocator_reserve_blocks[i]);
+		}
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+
+	spin_lock_irqsave(&block_mgr->lock, flags);
+	for (idx = LWIS_ALLOCATOR_MIN_POOL_IDX; idx <= LWIS_ALLOCATOR_MAX_POOL_IDX; idx++) {
+		block_pool = allocator_get_block_pool(block_mgr, idx);
+		block_pool->high_watermark = max(LWIS_ALLOCATOR_POOL_HIGH_WATERMARK_BYTES >> idx,
+						 allocator_magazine_batch(idx));
+		block_pool->low_watermark = block_pool->high_watermark / 2;
+		i = idx - LWIS_ALLOCATOR_MIN_POOL_IDX;
+		block_pool->high_watermark = max(block_pool->high_watermark, reserved[i]);
+		block_pool->low_watermark = max(block_pool->low_watermark, reserved[i]);
+		if (block_pool->free_count > block_pool->high_watermark) {
+			needs_trim = true;
+		}
+	}
+	spin_unlock_irqrestore(&block_mgr->lock, flags);
+
+	if (needs_trim) {
+		schedule_work(&block_mgr->trim_work);
+	}
+}
+
+static void allocator_outstanding_inc(struct lwis_allocator_block_pool *block_pool)
+{
+	int outstanding = atomic_inc_return(&block_pool->outstanding_count);
+	int peak = atomic_read(&block_pool->peak_outstanding_count);
+
+	while (outstanding > peak &&
+	       !atomic_try_cmpxchg(&block_pool->peak_outstanding_count, &peak, outstanding)) {
+	}
+}
+
 int lwis_allocator_init(struct lwis_device *lwis_dev)
 {
 	struct lwis_allocator_block_mgr *block_mgr;
+	struct lwis_allocator_block_pool *block_pool;
+	int idx;
+	int ret;
 
 	if (lwis_dev == NULL) {
 		dev_err(lwis_dev->dev, "lwis_dev is NULL\n");
@@ -175,8 +463,14 @@ int lwis_allocator_init(struct lwis_device *lwis_dev)
 	/* Initialize mutex */
 	spin_lock_init(&block_mgr->lock);
 
-	/* Empty hash table for allocated blocks */
-	hash_init(block_mgr->allocated_blocks);
+	/* Per-CPU magazines start empty and are filled by frees */
+	block_mgr->cpu_cache = alloc_percpu(struct lwis_allocator_cpu_cache);
+	if (block_mgr->cpu_cache == NULL) {
+		dev_err(lwis_dev->dev, "Allocate per-CPU cache failed\n");
+		kfree(block_mgr);
+		mutex_unlock(&lwis_dev->client_lock);
+		return -ENOMEM;
+	}
 
 	/* Initialize block pools */
 	strlcpy(block_mgr->pool_8k.name, "lwis-block-8k", LWIS_MAX_NAME_STRING_LEN);
@@ -188,6 +482,40 @@ int lwis_allocator_init(struct lwis_device *lwis_dev)
 	strlcpy(block_mgr->pool_512k.name, "lwis-block-512k", LWIS_MAX_NAME_STRING_LEN);
 	strlcpy(block_mgr->pool_large.name, "lwis-block-large", LWIS_MAX_NAME_STRING_LEN);
 
+	for (idx = LWIS_ALLOCATOR_MIN_POOL_IDX; idx <= LWIS_ALLOCATOR_MAX_POOL_IDX; idx++) {
+		block_pool = allocator_get_block_pool(block_mgr, idx);
+		block_pool->block_size = 1 << idx;
+	}
+	INIT_WORK(&block_mgr->trim_work, allocator_trim_work_func);
+
+	/* Bound the number of free blocks each pool keeps around */
+	allocator_update_reservations_locked(lwis_dev, block_mgr);
+
+	/* Give cached blocks back to the system under memory pressure */
+	block_mgr->shrinker.count_objects = allocator_shrink_count;
+	block_mgr->shrinker.scan_objects = allocator_shrink_scan;
+	block_mgr->shrinker.seeks = DEFAULT_SEEKS;
+	ret = register_shrinker(&block_mgr->shrinker);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Register shrinker failed: %d\n", ret);
+		free_percpu(block_mgr->cpu_cache);
+		kfree(block_mgr);
+		mutex_unlock(&lwis_dev->client_lock);
+		return ret;
+	}
+
+	/* Pre-warm the pools requested by the device tree, so that the first
+	 * allocations do not pay for kvmalloc(). Not being able to do so is not
+	 * fatal, the pools will be filled on demand. */
+	for (idx = LWIS_ALLOCATOR_MIN_POOL_IDX; idx <= LWIS_ALLOCATOR_MAX_POOL_IDX; idx++) {
+		if (lwis_dev->allocator_reserve_blocks[idx - LWIS_ALLOCATOR_MIN_POOL_IDX] == 0) {
+			continue;
+		}
+		allocator_block_pool_fill(
+			lwis_dev, block_mgr, idx,
+			lwis_dev->allocator_reserve_blocks[idx - LWIS_ALLOCATOR_MIN_POOL_IDX]);
+	}
+
 	/* Initialize reference count */
 	block_mgr->ref_count = 1;
 
@@ -216,10 +544,18 @@ void lwis_allocator_release(struct lwis_device *lwis_dev)
 
 	block_mgr->ref_count--;
 	if (block_mgr->ref_count > 0) {
+		/* Drop the reservations of the client that went away */
+		allocator_update_reservations_locked(lwis_dev, block_mgr);
 		mutex_unlock(&lwis_dev->client_lock);
 		return;
 	}
 
+	/* Return the blocks cached by each CPU before freeing the pools */
+	unregister_shrinker(&block_mgr->shrinker);
+	allocator_magazines_flush(block_mgr);
+	cancel_work_sync(&block_mgr->trim_work);
+	free_percpu(block_mgr->cpu_cache);
+
 	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_8k);
 	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_16k);
 	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_32k);
@@ -238,6 +574,7 @@ void *lwis_allocator_allocate(struct lwis_device *lwis_dev, size_t size)
 	struct lwis_allocator_block_mgr *block_mgr;
 	struct lwis_allocator_block_pool *block_pool;
 	struct lwis_allocator_block *block;
+	struct lwis_allocator_magazine *magazine;
 	uint32_t idx;
 	size_t block_size;
 	unsigned long flags;
@@ -257,8 +594,17 @@ void *lwis_allocator_allocate(struct lwis_device *lwis_dev, size_t size)
 	 * The default page size is 4K. We can leverage linux's slab implementation for
 	 * small size memory recycling.
 	 */
-	if (size <= 4 * 1024) {
-		return kmalloc(size, GFP_KERNEL);
+	if (check_add_overflow(size, (size_t)LWIS_ALLOCATOR_HEADER_SIZE, &block_size)) {
+		dev_err(lwis_dev->dev, "Allocation size %zu is too large\n", size);
+		return NULL;
+	}
+	if (block_size <= 4 * 1024) {
+		block = kmalloc(block_size, GFP_KERNEL);
+		if (block == NULL) {
+			return NULL;
+		}
+		block->type = LWIS_ALLOCATOR_TYPE_SLAB;
+		return (uint8_t *)block + LWIS_ALLOCATOR_HEADER_SIZE;
 	}
 
 	/*
@@ -289,8 +635,11 @@ void *lwis_allocator_allocate(struct lwis_device *lwis_dev, size_t size)
 	     if (size <=  8 * 1024 * 1024) return 23;
 	     if (size <=  16 * 1024 * 1024) return 24;
 	     if (size <=  32 * 1024 * 1024) return 25;
+
+	   The size class is chosen for the block size, which includes the
+	   header in front of the memory handed out.
 	*/
-	idx = fls(size - 1);
+	idx = fls(block_size - 1);
 
 	/*
 	 * For the large size memory allocation, we usually use kvmalloc() to allocate
@@ -300,26 +649,20 @@ void *lwis_allocator_allocate(struct lwis_device *lwis_dev, size_t size)
 	 * implementation, I do not cache it due to prevent keeping too much unused
 	 * memory on hand.
 	 */
-	if (idx > 19) {
-		block = kmalloc(sizeof(struct lwis_allocator_block), GFP_KERNEL);
+	if (idx > LWIS_ALLOCATOR_MAX_POOL_IDX) {
+		block = kvmalloc(block_size, GFP_KERNEL);
 		if (block == NULL) {
 			dev_err(lwis_dev->dev, "Allocate failed\n");
 			return NULL;
 		}
 		block->type = idx;
 		block->next = NULL;
-		block->prev = NULL;
-		block->ptr = kvmalloc(size, GFP_KERNEL);
-		if (block->ptr == NULL) {
-			dev_err(lwis_dev->dev, "Allocate failed\n");
-			kfree(block);
-			return NULL;
-		}
 		spin_lock_irqsave(&block_mgr->lock, flags);
 		block_mgr->pool_large.in_use_count++;
-		hash_add(block_mgr->allocated_blocks, &block->node, (unsigned long long)block->ptr);
+		block_mgr->pool_large.miss_count++;
 		spin_unlock_irqrestore(&block_mgr->lock, flags);
-		return block->ptr;
+		allocator_outstanding_inc(&block_mgr->pool_large);
+		return (uint8_t *)block + LWIS_ALLOCATOR_HEADER_SIZE;
 	}
 
 	block_pool = allocator_get_block_pool(block_mgr, idx);
@@ -327,50 +670,45 @@ void *lwis_allocator_allocate(struct lwis_device *lwis_dev, size_t size)
 		return NULL;
 	}
 
-	/* Try to get free block from recycling block pool */
-	spin_lock_irqsave(&block_mgr->lock, flags);
-	block = allocator_free_block_get_locked(block_pool);
-	spin_unlock_irqrestore(&block_mgr->lock, flags);
+	/* Try to get free block from this CPU's magazine first, and refill it
+	 * in bulk from the recycling block pool when it runs empty */
+	local_irq_save(flags);
+	magazine = allocator_magazine_get(block_mgr, idx);
+	magazine->alloc_count++;
+	if (magazine->count == 0) {
+		allocator_magazine_refill(block_mgr, block_pool, magazine, idx);
+	}
+	block = (magazine->count > 0) ? magazine->blocks[--magazine->count] : NULL;
+	local_irq_restore(flags);
 	if (block != NULL) {
-		return block->ptr;
+		allocator_outstanding_inc(block_pool);
+		return (uint8_t *)block + LWIS_ALLOCATOR_HEADER_SIZE;
 	}
 
 	/* Allocate new block */
-	block = kmalloc(sizeof(struct lwis_allocator_block), GFP_KERNEL);
+	block = kvmalloc(1 << idx, GFP_KERNEL);
 	if (block == NULL) {
 		dev_err(lwis_dev->dev, "Allocate failed\n");
 		return NULL;
 	}
 	block->type = idx;
 	block->next = NULL;
-	block->prev = NULL;
-	block_size = 1 << idx;
-	block->ptr = kvmalloc(block_size, GFP_KERNEL);
-	if (block->ptr == NULL) {
-		dev_err(lwis_dev->dev, "Allocate failed\n");
-		kfree(block);
-		return NULL;
-	}
 
 	spin_lock_irqsave(&block_mgr->lock, flags);
-	block->next = block_pool->in_use;
-	if (block->next != NULL) {
-		block->next->prev = block;
-	}
-	block_pool->in_use = block;
 	block_pool->in_use_count++;
-	hash_add(block_mgr->allocated_blocks, &block->node, (unsigned long long)block->ptr);
+	block_pool->miss_count++;
 	spin_unlock_irqrestore(&block_mgr->lock, flags);
+	allocator_outstanding_inc(block_pool);
 
-	return block->ptr;
+	return (uint8_t *)block + LWIS_ALLOCATOR_HEADER_SIZE;
 }
 
 void lwis_allocator_free(struct lwis_device *lwis_dev, void *ptr)
 {
 	struct lwis_allocator_block_mgr *block_mgr;
 	struct lwis_allocator_block_pool *block_pool;
-	struct lwis_allocator_block *block = NULL;
-	struct lwis_allocator_block *blk;
+	struct lwis_allocator_block *block;
+	struct lwis_allocator_magazine *magazine;
 	unsigned long flags;
 
 	if (lwis_dev == NULL || ptr == NULL) {
@@ -382,33 +720,20 @@ void lwis_allocator_free(struct lwis_device *lwis_dev, void *ptr)
 		dev_err(lwis_dev->dev, "block_mgr is NULL\n");
 		return;
 	}
-	hash_for_each_possible (block_mgr->allocated_blocks, blk, node, (unsigned long long)ptr) {
-		if (blk->ptr == ptr) {
-			block = blk;
-			break;
-		}
-	}
 
-	if (block == NULL) {
-		kfree(ptr);
+	block = (struct lwis_allocator_block *)((uint8_t *)ptr - LWIS_ALLOCATOR_HEADER_SIZE);
+
+	if (block->type == LWIS_ALLOCATOR_TYPE_SLAB) {
+		kfree(block);
 		return;
 	}
 
-	if (block->type > 19) {
-		struct lwis_allocator_block *b;
-		struct hlist_node *n;
+	if (block->type > LWIS_ALLOCATOR_MAX_POOL_IDX) {
 		spin_lock_irqsave(&block_mgr->lock, flags);
-		hash_for_each_possible_safe (block_mgr->allocated_blocks, b, n, node,
-					     (unsigned long long)ptr) {
-			if (b->ptr == block->ptr) {
-				hash_del(&b->node);
-				break;
-			}
-		}
-		kvfree(block->ptr);
-		kfree(block);
 		block_mgr->pool_large.in_use_count--;
 		spin_unlock_irqrestore(&block_mgr->lock, flags);
+		atomic_dec(&block_mgr->pool_large.outstanding_count);
+		kvfree(block);
 		return;
 	}
 
@@ -418,9 +743,137 @@ void lwis_allocator_free(struct lwis_device *lwis_dev, void *ptr)
 		return;
 	}
 
+	atomic_dec(&block_pool->outstanding_count);
+
+	/* Put the block into this CPU's magazine, and drain it in bulk to the
+	 * recycling block pool when it is full */
+	local_irq_save(flags);
+	magazine = allocator_magazine_get(block_mgr, block->type);
+	if (magazine->count >= allocator_magazine_size(block->type)) {
+		allocator_magazine_drain(block_mgr, block_pool, magazine, block->type,
+					 allocator_magazine_size(block->type) -
+						 allocator_magazine_batch(block->type));
+	}
+	magazine->blocks[magazine->count++] = block;
+	local_irq_restore(flags);
+
+	return;
+}
+
+int lwis_allocator_reserve(struct lwis_client *lwis_client, size_t size, uint32_t num_blocks)
+{
+	struct lwis_device *lwis_dev;
+	struct lwis_allocator_block_mgr *block_mgr;
+	size_t block_size;
+	uint32_t max_blocks;
+	int idx;
+	int ret;
+
+	if (lwis_client == NULL) {
+		pr_err("lwis_client is NULL\n");
+		return -EINVAL;
+	}
+	lwis_dev = lwis_client->lwis_dev;
+
+	if (check_add_overflow(size, (size_t)LWIS_ALLOCATOR_HEADER_SIZE, &block_size)) {
+		dev_err(lwis_dev->dev, "Cannot reserve blocks for size %zu\n", size);
+		return -EINVAL;
+	}
+
+	/* Small allocations are served by kmalloc and need no reservation */
+	if (block_size <= 4 * 1024) {
+		return 0;
+	}
+
+	idx = fls(block_size - 1);
+	if (idx > LWIS_ALLOCATOR_MAX_POOL_IDX) {
+		dev_err(lwis_dev->dev, "Cannot reserve blocks for size %zu\n", size);
+		return -EINVAL;
+	}
+
+	max_blocks = max_t(uint32_t, LWIS_ALLOCATOR_MAX_RESERVE_BYTES >> idx,
+			   lwis_dev->allocator_reserve_blocks[idx - LWIS_ALLOCATOR_MIN_POOL_IDX]);
+	if (num_blocks > max_blocks) {
+		dev_err(lwis_dev->dev, "Cannot reserve %u blocks for size %zu, at most %u\n",
+			num_blocks, size, max_blocks);
+		return -EINVAL;
+	}
+
+	mutex_lock(&lwis_dev->client_lock);
+	block_mgr = lwis_dev->block_mgr;
+	if (block_mgr == NULL) {
+		dev_err(lwis_dev->dev, "block_mgr is NULL\n");
+		mutex_unlock(&lwis_dev->client_lock);
+		return -EINVAL;
+	}
+
+	lwis_client->allocator_reserve_blocks[idx - LWIS_ALLOCATOR_MIN_POOL_IDX] = num_blocks;
+	allocator_update_reservations_locked(lwis_dev, block_mgr);
+	ret = allocator_block_pool_fill(lwis_dev, block_mgr, idx, num_blocks);
+	mutex_unlock(&lwis_dev->client_lock);
+
+	return ret;
+}
+
+static void allocator_block_pool_get_stats(struct lwis_allocator_block_mgr *block_mgr,
+					   struct lwis_allocator_block_pool *block_pool, int pool_idx,
+					   struct lwis_allocator_pool_stats *stats)
+{
+	struct lwis_allocator_magazine *magazine;
+	unsigned long flags;
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+	strlcpy(stats->name, block_pool->name, LWIS_MAX_NAME_STRING_LEN);
+	stats->block_size = block_pool->block_size;
+	stats->high_watermark = block_pool->high_watermark;
+	stats->low_watermark = block_pool->low_watermark;
+	stats->in_use_count = atomic_read(&block_pool->outstanding_count);
+	stats->peak_in_use_count = atomic_read(&block_pool->peak_outstanding_count);
+
 	spin_lock_irqsave(&block_mgr->lock, flags);
-	allocator_free_block_put_locked(block_pool, block);
+	stats->miss_count = block_pool->miss_count;
+	stats->cached_count = block_pool->free_count;
 	spin_unlock_irqrestore(&block_mgr->lock, flags);
 
-	return;
+	/* Large blocks are never cached, every allocation is a miss */
+	if (pool_idx < 0) {
+		stats->alloc_count = stats->miss_count;
+		return;
+	}
+
+	/* Per-CPU counters are read without synchronization */
+	for_each_possible_cpu (cpu) {
+		magazine = &per_cpu_ptr(block_mgr->cpu_cache, cpu)->magazines[pool_idx];
+		stats->alloc_count += READ_ONCE(magazine->alloc_count);
+		stats->cached_count += READ_ONCE(magazine->count);
+	}
+	if (stats->alloc_count > stats->miss_count) {
+		stats->hit_count = stats->alloc_count - stats->miss_count;
+	}
+	stats->cached_bytes = (size_t)stats->cached_count * stats->block_size;
+}
+
+int lwis_allocator_get_stats(struct lwis_device *lwis_dev, struct lwis_allocator_pool_stats *stats)
+{
+	struct lwis_allocator_block_mgr *block_mgr;
+	int idx;
+
+	mutex_lock(&lwis_dev->client_lock);
+	block_mgr = lwis_dev->block_mgr;
+	if (block_mgr == NULL) {
+		mutex_unlock(&lwis_dev->client_lock);
+		return -ENODEV;
+	}
+
+	for (idx = LWIS_ALLOCATOR_MIN_POOL_IDX; idx <= LWIS_ALLOCATOR_MAX_POOL_IDX; idx++) {
+		allocator_block_pool_get_stats(block_mgr, allocator_get_block_pool(block_mgr, idx),
+					       idx - LWIS_ALLOCATOR_MIN_POOL_IDX,
+					       &stats[idx - LWIS_ALLOCATOR_MIN_POOL_IDX]);
+	}
+	allocator_block_pool_get_stats(block_mgr, &block_mgr->pool_large, -1,
+				       &stats[LWIS_ALLOCATOR_NUM_POOLS]);
+
+	mutex_unlock(&lwis_dev->client_lock);
+	return 0;
 }
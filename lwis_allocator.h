@@ -13,27 +13,93 @@
 #define LWIS_ALLOCATOR_H_
 
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/shrinker.h>
+#include <linux/workqueue.h>
 #include "lwis_commands.h"
 #include "lwis_device.h"
 
+/* Range of fls() of the recycling block pool sizes, see LWIS_ALLOCATOR_NUM_POOLS */
+#define LWIS_ALLOCATOR_MIN_POOL_IDX 13
+#define LWIS_ALLOCATOR_MAX_POOL_IDX 19
+
+/* Most free blocks each CPU can cache per pool. The depth of a pool is scaled
+ * down so a CPU caches about LWIS_ALLOCATOR_MAGAZINE_BYTES of it, with at least
+ * one block. Half of the depth is moved from/to the shared pool when the
+ * per-CPU cache runs empty/full */
+#define LWIS_ALLOCATOR_MAGAZINE_SIZE 8
+#define LWIS_ALLOCATOR_MAGAZINE_BYTES (128 * 1024)
+
+/* Bytes each pool may keep on its free list and in the per-CPU caches before
+ * it is trimmed back to half of that. Pools of large blocks keep at least one
+ * per-CPU cache refill of blocks. */
+#define LWIS_ALLOCATOR_POOL_HIGH_WATERMARK_BYTES (2 * 1024 * 1024)
+
+/* Most bytes a client may ask a pool to keep reserved, unless the device tree
+ * reserves more blocks for that pool */
+#define LWIS_ALLOCATOR_MAX_RESERVE_BYTES (8 * 1024 * 1024)
+/* Most entries taken by a single LWIS_ALLOCATOR_RESERVE */
+#define LWIS_ALLOCATOR_MAX_RESERVE_ENTRIES 16
+
+/* Block type of small allocations served directly by kmalloc */
+#define LWIS_ALLOCATOR_TYPE_SLAB 0
+
+/*
+ *  struct lwis_allocator_block
+ *  Header placed in front of every allocation. The caller gets the memory
+ *  right after the header, so the block, and therefore its size class, is
+ *  found from the pointer without any lookup.
+ */
 struct lwis_allocator_block {
+	/* LWIS_ALLOCATOR_TYPE_SLAB, or fls() of the block size */
 	int type;
-	void *ptr;
+	/* Next block in the pool free list, only valid while on that list */
 	struct lwis_allocator_block *next;
-	struct lwis_allocator_block *prev;
-	struct hlist_node node;
 };
 
+/* Keep the memory handed out 16-byte aligned */
+#define LWIS_ALLOCATOR_HEADER_SIZE ALIGN(sizeof(struct lwis_allocator_block), 16)
+
 struct lwis_allocator_block_pool {
 	char name[LWIS_MAX_NAME_STRING_LEN];
+	/* Size of each block, including the header */
+	size_t block_size;
 	struct lwis_allocator_block *free;
 	uint32_t free_count;
-	struct lwis_allocator_block *in_use;
+	/* Blocks not on the free list, including the ones cached by CPUs */
 	uint32_t in_use_count;
+	/* Once free_count goes above high_watermark, the free list is trimmed
+	 * back to low_watermark */
+	uint32_t high_watermark;
+	uint32_t low_watermark;
+	/* Number of allocations that could not reuse a block */
+	uint64_t miss_count;
+	/* Number of blocks handed out to callers, and its maximum */
+	atomic_t outstanding_count;
+	atomic_t peak_outstanding_count;
+};
+
+/*
+ *  struct lwis_allocator_magazine
+ *  Per-CPU stack of blocks taken from a shared pool. Blocks held here are
+ *  still accounted as in use by the shared pool.
+ */
+struct lwis_allocator_magazine {
+	uint32_t count;
+	struct lwis_allocator_block *blocks[LWIS_ALLOCATOR_MAGAZINE_SIZE];
+	/* Number of allocations from this pool on this CPU */
+	uint64_t alloc_count;
+};
+
+struct lwis_allocator_cpu_cache {
+	struct lwis_allocator_magazine magazines[LWIS_ALLOCATOR_NUM_POOLS];
 };
 
 struct lwis_allocator_block_mgr {
 	spinlock_t lock;
+	/* Per-CPU magazines in front of the shared pools, accessed with local
+	 * interrupts disabled instead of taking lock */
+	struct lwis_allocator_cpu_cache __percpu *cpu_cache;
 	struct lwis_allocator_block_pool pool_8k;
 	struct lwis_allocator_block_pool pool_16k;
 	struct lwis_allocator_block_pool pool_32k;
@@ -42,11 +108,35 @@ struct lwis_allocator_block_mgr {
 	struct lwis_allocator_block_pool pool_256k;
 	struct lwis_allocator_block_pool pool_512k;
 	struct lwis_allocator_block_pool pool_large;
-	/* Hash table of allocated buffers keyed by allocated addresses */
-	DECLARE_HASHTABLE(allocated_blocks, BUFFER_HASH_BITS);
+	/* Trims the free lists that went above their high watermark */
+	struct work_struct trim_work;
+	/* Gives all cached blocks back under memory pressure */
+	struct shrinker shrinker;
 	int ref_count;
 };
 
+/*
+ *  struct lwis_allocator_pool_stats
+ *  Snapshot of the counters of one block pool, for debugging and tuning.
+ */
+struct lwis_allocator_pool_stats {
+	char name[LWIS_MAX_NAME_STRING_LEN];
+	size_t block_size;
+	uint64_t alloc_count;
+	uint64_t hit_count;
+	uint64_t miss_count;
+	/* Free blocks kept by the pool and the per-CPU magazines */
+	uint32_t cached_count;
+	size_t cached_bytes;
+	uint32_t in_use_count;
+	uint32_t peak_in_use_count;
+	uint32_t high_watermark;
+	uint32_t low_watermark;
+};
+
+/* One entry per recycling pool plus one for the large blocks */
+#define LWIS_ALLOCATOR_NUM_STATS (LWIS_ALLOCATOR_NUM_POOLS + 1)
+
 /*
  *  lwis_allocator_init: Initialize the recycling memory allocator
  */
@@ -68,4 +158,22 @@ void *lwis_allocator_allocate(struct lwis_device *lwis_dev, size_t size);
  */
 void lwis_allocator_free(struct lwis_device *lwis_dev, void *ptr);
 
+/*
+ *  lwis_allocator_reserve: Make sure the pool serving allocations of the given
+ *  size keeps at least num_blocks free blocks, allocating them now. This
+ *  replaces the client's previous reservation for that pool and is dropped
+ *  when the client is released. num_blocks is capped by
+ *  LWIS_ALLOCATOR_MAX_RESERVE_BYTES, or by the device tree reservation if that
+ *  is larger. Allocations that are not served by a recycling pool cannot be
+ *  reserved.
+ */
+int lwis_allocator_reserve(struct lwis_client *lwis_client, size_t size, uint32_t num_blocks);
+
+/*
+ *  lwis_allocator_get_stats: Fill stats with a snapshot of each block pool.
+ *  stats must hold LWIS_ALLOCATOR_NUM_STATS entries.
+ *  Returns -ENODEV if the allocator is not initialized.
+ */
+int lwis_allocator_get_stats(struct lwis_device *lwis_dev, struct lwis_allocator_pool_stats *stats);
+
 #endif /* LWIS_ALLOCATOR_H_ */
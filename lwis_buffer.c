@@ -82,6 +82,111 @@ static void dump_total_enrolled_buffer_size(struct lwis_device *lwis_dev)
 	}
 }
 
+static void buffer_mapping_release(struct lwis_client *client, struct dma_buf *dma_buf,
+				   struct dma_buf_attachment *attachment, struct sg_table *sg_table,
+				   enum dma_data_direction dma_direction, dma_addr_t dma_vaddr)
+{
+	lwis_platform_dma_buffer_unmap(client->lwis_dev, attachment, dma_vaddr);
+	dma_buf_unmap_attachment(attachment, sg_table, dma_direction);
+	dma_buf_detach(dma_buf, attachment);
+	dma_buf_put(dma_buf);
+}
+
+static void buffer_mapping_remove(struct lwis_client *client, struct lwis_buffer_mapping *mapping)
+{
+	hash_del(&mapping->node);
+	list_del(&mapping->lru_node);
+	client->num_buffer_mappings--;
+	client->buffer_mapping_bytes -= mapping->dma_buf->size;
+}
+
+static void buffer_mapping_evict(struct lwis_client *client, struct lwis_buffer_mapping *mapping)
+{
+	buffer_mapping_remove(client, mapping);
+	buffer_mapping_release(client, mapping->dma_buf, mapping->dma_buf_attachment,
+			       mapping->sg_table, mapping->dma_direction, mapping->dma_vaddr);
+	kfree(mapping);
+}
+
+/*
+ * Evicts all idle mappings of dma_buf, or every idle mapping if dma_buf is NULL.
+ * Returns the number of mappings evicted.
+ */
+static int buffer_mappings_evict(struct lwis_client *client, struct dma_buf *dma_buf)
+{
+	struct lwis_buffer_mapping *mapping, *n;
+	int num_evicted = 0;
+
+	list_for_each_entry_safe (mapping, n, &client->buffer_mapping_lru, lru_node) {
+		if (dma_buf == NULL || mapping->dma_buf == dma_buf) {
+			buffer_mapping_evict(client, mapping);
+			num_evicted++;
+		}
+	}
+	return num_evicted;
+}
+
+/*
+ * Takes an idle mapping of dma_buf with the given direction out of the cache.
+ * The caller owns the returned mapping, including its dma_buf reference.
+ */
+static struct lwis_buffer_mapping *buffer_mapping_take(struct lwis_client *client,
+						       struct dma_buf *dma_buf,
+						       enum dma_data_direction dma_direction)
+{
+	struct lwis_buffer_mapping *mapping;
+
+	hash_for_each_possible (client->buffer_mappings, mapping, node, (unsigned long)dma_buf) {
+		if (mapping->dma_buf == dma_buf && mapping->dma_direction == dma_direction) {
+			buffer_mapping_remove(client, mapping);
+			return mapping;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Moves the IO mapping of a disenrolled buffer into the cache, including its
+ * dma_buf reference. The mapping is released right away if it can't be cached.
+ */
+static void buffer_mapping_put(struct lwis_client *client, struct lwis_enrolled_buffer *buffer)
+{
+	struct lwis_buffer_mapping *mapping;
+
+	/* A buffer that would take most of the cache is not worth keeping */
+	if (buffer->dma_buf->size > LWIS_BUFFER_MAPPING_CACHE_MAX_BYTES / 2) {
+		buffer_mapping_release(client, buffer->dma_buf, buffer->dma_buf_attachment,
+				       buffer->sg_table, buffer->dma_direction,
+				       buffer->info.dma_vaddr);
+		return;
+	}
+
+	mapping = kmalloc(sizeof(struct lwis_buffer_mapping), GFP_KERNEL);
+	if (!mapping) {
+		buffer_mapping_release(client, buffer->dma_buf, buffer->dma_buf_attachment,
+				       buffer->sg_table, buffer->dma_direction,
+				       buffer->info.dma_vaddr);
+		return;
+	}
+
+	mapping->dma_direction = buffer->dma_direction;
+	mapping->dma_buf = buffer->dma_buf;
+	mapping->dma_buf_attachment = buffer->dma_buf_attachment;
+	mapping->sg_table = buffer->sg_table;
+	mapping->dma_vaddr = buffer->info.dma_vaddr;
+	hash_add(client->buffer_mappings, &mapping->node, (unsigned long)mapping->dma_buf);
+	list_add_tail(&mapping->lru_node, &client->buffer_mapping_lru);
+	client->num_buffer_mappings++;
+	client->buffer_mapping_bytes += mapping->dma_buf->size;
+
+	while (client->num_buffer_mappings > LWIS_BUFFER_MAPPING_CACHE_SIZE ||
+	       client->buffer_mapping_bytes > LWIS_BUFFER_MAPPING_CACHE_MAX_BYTES) {
+		buffer_mapping_evict(client,
+				     list_first_entry(&client->buffer_mapping_lru,
+						      struct lwis_buffer_mapping, lru_node));
+	}
+}
+
 int lwis_buffer_alloc(struct lwis_client *lwis_client, struct lwis_alloc_buffer_info *alloc_info,
 		      struct lwis_allocated_buffer *buffer)
 {
@@ -162,17 +267,72 @@ int lwis_buffer_free(struct lwis_client *lwis_client, struct lwis_allocated_buff
 			return -EINVAL;
 		}
 	} else {
+		/* Idle mappings would otherwise keep the buffer alive */
+		buffer_mappings_evict(lwis_client, buffer->dma_buf);
 		dma_buf_put(buffer->dma_buf);
 	}
 	hash_del(&buffer->node);
 	return 0;
 }
 
+/*
+ * Attaches and maps buffer->dma_buf into IO space. On failure the dma_buf
+ * reference held by buffer is dropped.
+ */
+static int buffer_map(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer)
+{
+	buffer->dma_buf_attachment =
+		dma_buf_attach(buffer->dma_buf, &lwis_client->lwis_dev->plat_dev->dev);
+	if (IS_ERR_OR_NULL(buffer->dma_buf_attachment)) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"Could not attach dma buffer for fd: %d (errno: %ld)", buffer->info.fd,
+			PTR_ERR(buffer->dma_buf_attachment));
+		dma_buf_put(buffer->dma_buf);
+		return PTR_ERR(buffer->dma_buf_attachment);
+	}
+
+	buffer->sg_table =
+		dma_buf_map_attachment(buffer->dma_buf_attachment, buffer->dma_direction);
+	if (PTR_ERR(buffer->sg_table) == -ENOMEM &&
+	    buffer_mappings_evict(lwis_client, NULL) > 0) {
+		/* Retry once IO space held by idle mappings has been given back */
+		buffer->sg_table =
+			dma_buf_map_attachment(buffer->dma_buf_attachment, buffer->dma_direction);
+	}
+	if (IS_ERR_OR_NULL(buffer->sg_table)) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"Could not map dma attachment for fd: %d (errno: %ld)", buffer->info.fd,
+			PTR_ERR(buffer->sg_table));
+		if (PTR_ERR(buffer->sg_table) == -ENOMEM) {
+			lwis_device_info_dump("Enroll buffer sizes",
+					      dump_total_enrolled_buffer_size);
+		}
+		dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
+		dma_buf_put(buffer->dma_buf);
+		return PTR_ERR(buffer->sg_table);
+	}
+
+	buffer->info.dma_vaddr = sg_dma_address(buffer->sg_table->sgl);
+	if (IS_ERR_OR_NULL((void *)buffer->info.dma_vaddr)) {
+		dev_err(lwis_client->lwis_dev->dev, "Could not map dma vaddr for fd: %d",
+			buffer->info.fd);
+		dma_buf_unmap_attachment(buffer->dma_buf_attachment, buffer->sg_table,
+					 buffer->dma_direction);
+		dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
+		dma_buf_put(buffer->dma_buf);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer)
 {
 	struct lwis_buffer_enrollment_list *enrollment_list;
 	struct list_head *it_enrollment;
 	struct lwis_enrolled_buffer *old_buffer;
+	struct lwis_buffer_mapping *mapping;
+	int ret;
 
 	if (!lwis_client) {
 		pr_err("Enroll: LWIS client is NULL\n");
@@ -206,36 +366,19 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
 		return PTR_ERR(buffer->dma_buf);
 	}
 
-	buffer->dma_buf_attachment =
-		dma_buf_attach(buffer->dma_buf, &lwis_client->lwis_dev->plat_dev->dev);
-	if (IS_ERR_OR_NULL(buffer->dma_buf_attachment)) {
-		dev_err(lwis_client->lwis_dev->dev,
-			"Could not attach dma buffer for fd: %d (errno: %ld)", buffer->info.fd,
-			PTR_ERR(buffer->dma_buf_attachment));
+	mapping = buffer_mapping_take(lwis_client, buffer->dma_buf, buffer->dma_direction);
+	if (mapping) {
+		/* The cached mapping already holds a reference to the dma_buf */
 		dma_buf_put(buffer->dma_buf);
-		return PTR_ERR(buffer->dma_buf_attachment);
-	}
-
-	buffer->sg_table =
-		dma_buf_map_attachment(buffer->dma_buf_attachment, buffer->dma_direction);
-	if (IS_ERR_OR_NULL(buffer->sg_table)) {
-		dev_err(lwis_client->lwis_dev->dev,
-			"Could not map dma attachment for fd: %d (errno: %ld)", buffer->info.fd,
-			PTR_ERR(buffer->sg_table));
-		if (PTR_ERR(buffer->sg_table) == -ENOMEM) {
-			lwis_device_info_dump("Enroll buffer sizes",
-					      dump_total_enrolled_buffer_size);
+		buffer->dma_buf_attachment = mapping->dma_buf_attachment;
+		buffer->sg_table = mapping->sg_table;
+		buffer->info.dma_vaddr = mapping->dma_vaddr;
+		kfree(mapping);
+	} else {
+		ret = buffer_map(lwis_client, buffer);
+		if (ret) {
+			return ret;
 		}
-		dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
-		dma_buf_put(buffer->dma_buf);
-		return PTR_ERR(buffer->sg_table);
-	}
-
-	buffer->info.dma_vaddr = sg_dma_address(buffer->sg_table->sgl);
-	if (IS_ERR_OR_NULL((void *)buffer->info.dma_vaddr)) {
-		dev_err(lwis_client->lwis_dev->dev, "Could not map dma vaddr for fd: %d",
-			buffer->info.fd);
-		goto err;
 	}
 
 	// Insert the new enrollment to the enrolled_buffers hashtable.
@@ -261,14 +404,13 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
 
 	return 0;
 err:
-	dma_buf_unmap_attachment(buffer->dma_buf_attachment, buffer->sg_table,
-				 buffer->dma_direction);
-	dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
-	dma_buf_put(buffer->dma_buf);
+	buffer_mapping_release(lwis_client, buffer->dma_buf, buffer->dma_buf_attachment,
+			       buffer->sg_table, buffer->dma_direction, buffer->info.dma_vaddr);
 	return -EINVAL;
 }
 
-int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer)
+static int buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer,
+			    bool cache_mapping)
 {
 	if (!lwis_client) {
 		pr_err("Disenroll: LWIS client is NULL\n");
@@ -279,12 +421,14 @@ int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_
 		return -EINVAL;
 	}
 
-	lwis_platform_dma_buffer_unmap(lwis_client->lwis_dev, buffer->dma_buf_attachment,
+	if (cache_mapping) {
+		/* Keep the IO mapping around in case the buffer gets enrolled again */
+		buffer_mapping_put(lwis_client, buffer);
+	} else {
+		buffer_mapping_release(lwis_client, buffer->dma_buf, buffer->dma_buf_attachment,
+				       buffer->sg_table, buffer->dma_direction,
 				       buffer->info.dma_vaddr);
-	dma_buf_unmap_attachment(buffer->dma_buf_attachment, buffer->sg_table,
-				 buffer->dma_direction);
-	dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
-	dma_buf_put(buffer->dma_buf);
+	}
 	/* Delete the node from the hash table */
 	list_del(&buffer->list_node);
 	if (list_empty(&buffer->enrollment_list->list)) {
@@ -294,6 +438,17 @@ int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_
 	return 0;
 }
 
+int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer)
+{
+	return buffer_disenroll(lwis_client, buffer, /*cache_mapping=*/true);
+}
+
+int lwis_buffer_enroll_revert(struct lwis_client *lwis_client,
+			      struct lwis_enrolled_buffer *buffer)
+{
+	return buffer_disenroll(lwis_client, buffer, /*cache_mapping=*/false);
+}
+
 struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find(struct lwis_client *lwis_client,
 							      int fd, dma_addr_t dma_vaddr)
 {
@@ -388,6 +543,18 @@ int lwis_client_enrolled_buffers_clear(struct lwis_client *lwis_client)
 		}
 	}
 
+	/* Release the mappings cached by the disenrolls above */
+	return lwis_client_buffer_mappings_clear(lwis_client);
+}
+
+int lwis_client_buffer_mappings_clear(struct lwis_client *lwis_client)
+{
+	if (!lwis_client) {
+		pr_err("lwis_client_buffer_mappings_clear: LWIS client is NULL\n");
+		return -ENODEV;
+	}
+
+	buffer_mappings_evict(lwis_client, NULL);
 	return 0;
 }
 
@@ -19,6 +19,16 @@
 #include "lwis_commands.h"
 #include "lwis_device.h"
 
+/*
+ * Bounds on the idle buffer mappings kept by a client for re-enrollment. The
+ * byte bound counts the size of the dma_bufs, which the cache keeps alive.
+ */
+#define LWIS_BUFFER_MAPPING_CACHE_SIZE 16
+#define LWIS_BUFFER_MAPPING_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+/* Maximum number of buffers in one batch enroll or disenroll */
+#define LWIS_BUFFER_BATCH_MAX_ENTRIES 256
+
 struct lwis_enrolled_buffer {
 	struct lwis_buffer_info info;
 	enum dma_data_direction dma_direction;
@@ -29,6 +39,27 @@ struct lwis_enrolled_buffer {
 	struct lwis_buffer_enrollment_list *enrollment_list;
 };
 
+/*
+ * An IO mapping of a dma_buf that is no longer enrolled, kept around so that
+ * enrolling the same dma_buf again can skip the attach and IOMMU map. The
+ * mapping holds a reference to the dma_buf until it is evicted.
+ *
+ * Note that the IO address stays mapped to the buffer until then, so a device
+ * still doing DMA to a disenrolled buffer reaches its memory instead of taking
+ * an IOMMU fault. The buffer itself can't be freed under the device, but such
+ * a stale access goes unnoticed. LWIS_BUFFER_FREE and closing the client
+ * release the cached mappings right away.
+ */
+struct lwis_buffer_mapping {
+	enum dma_data_direction dma_direction;
+	struct dma_buf *dma_buf;
+	struct dma_buf_attachment *dma_buf_attachment;
+	struct sg_table *sg_table;
+	dma_addr_t dma_vaddr;
+	struct hlist_node node;
+	struct list_head lru_node;
+};
+
 struct lwis_allocated_buffer {
 	int fd;
 	size_t size;
@@ -64,7 +95,8 @@ int lwis_buffer_free(struct lwis_client *lwis_client, struct lwis_allocated_buff
 /*
  * lwis_buffer_enroll: Maps the DMA buffer represented by the file descriptor
  * passed in buffer->info.fd into IO space and adds the buffer object into
- * the table of this client's enrolled buffers
+ * the table of this client's enrolled buffers. An idle mapping of the same
+ * dma_buf and direction left by a previous disenroll is reused if present.
  *
  * Assumes: lwisclient->lock is locked
  * Alloc: Yes
@@ -73,8 +105,9 @@ int lwis_buffer_free(struct lwis_client *lwis_client, struct lwis_allocated_buff
 int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer);
 
 /*
- * lwis_buffer_disenroll: Unmaps the buffer from IO space and removes the
- * object from the hash table
+ * lwis_buffer_disenroll: Removes the object from the hash table and moves its
+ * IO mapping to the client's cache of idle mappings, evicting the least
+ * recently used ones while the cache is over its count or byte bound
  *
  * Assumes: lwisclient->lock is locked
  * Alloc: Yes
@@ -82,6 +115,18 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
  */
 int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer);
 
+/*
+ * lwis_buffer_enroll_revert: Undoes lwis_buffer_enroll for a buffer whose
+ * address never reached userspace. Unlike lwis_buffer_disenroll, the IO
+ * mapping is released right away instead of being cached.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Free only
+ * Returns: 0 on success
+ */
+int lwis_buffer_enroll_revert(struct lwis_client *lwis_client,
+			      struct lwis_enrolled_buffer *buffer);
+
 /*
  * lwis_buffer_cpu_access: Invalidate/flush the cache for CPU access to the dma buffers
  *
@@ -113,6 +158,16 @@ struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find(struct lwis_client
  */
 int lwis_client_enrolled_buffers_clear(struct lwis_client *lwis_client);
 
+/*
+ * lwis_client_buffer_mappings_clear: Unmaps all idle buffer mappings cached
+ * by the client and drops their dma_buf references.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Free only
+ * Returns: 0 on success
+ */
+int lwis_client_buffer_mappings_clear(struct lwis_client *lwis_client);
+
 /*
  * lwis_client_allocated_buffer_find: Finds the allocated buffer based on
  * file desciptor passed, and returns it
@@ -135,6 +135,30 @@ struct lwis_enrolled_buffer_info {
 	uint64_t dma_vaddr;
 };
 
+struct lwis_buffer_enroll_entry {
+	// IOCTL inputs and outputs, same as for BUFFER_ENROLL
+	struct lwis_buffer_info info;
+	// IOCTL output: 0 if the buffer was enrolled, negative errno otherwise
+	int32_t result;
+};
+
+struct lwis_buffer_enroll_batch {
+	size_t num_entries;
+	struct lwis_buffer_enroll_entry *entries;
+};
+
+struct lwis_buffer_disenroll_entry {
+	// IOCTL input, same as for BUFFER_DISENROLL
+	struct lwis_enrolled_buffer_info info;
+	// IOCTL output: 0 if the buffer was disenrolled, negative errno otherwise
+	int32_t result;
+};
+
+struct lwis_buffer_disenroll_batch {
+	size_t num_entries;
+	struct lwis_buffer_disenroll_entry *entries;
+};
+
 struct lwis_buffer_cpu_access_op {
 	int32_t fd;
 	bool start;
@@ -151,7 +175,8 @@ enum lwis_io_entry_types {
 	LWIS_IO_ENTRY_WRITE_BATCH,
 	LWIS_IO_ENTRY_MODIFY,
 	LWIS_IO_ENTRY_POLL,
-	LWIS_IO_ENTRY_READ_ASSERT
+	LWIS_IO_ENTRY_READ_ASSERT,
+	LWIS_IO_ENTRY_POLL_US
 };
 
 // For io_entry read and write types.
@@ -186,6 +211,20 @@ struct lwis_io_entry_read_assert {
 	uint64_t timeout_ms;
 };
 
+// For io_entry poll type with microsecond timing. The register is re-read
+// after interval_us, backing off exponentially from busy-waiting to sleeping.
+// In IRQ context the poll spins instead, and timeout_us is capped at 100us
+// (a ratelimited warning is logged when the cap applies). Must be no larger
+// than lwis_io_entry_read_assert so that lwis_io_entry keeps its size.
+struct lwis_io_entry_poll_us {
+	int32_t bid;
+	uint32_t interval_us;
+	uint64_t offset;
+	uint64_t val;
+	uint64_t mask;
+	uint32_t timeout_us;
+};
+
 struct lwis_io_entry {
 	int32_t type;
 	union {
@@ -193,6 +232,7 @@ struct lwis_io_entry {
 		struct lwis_io_entry_rw_batch rw_batch;
 		struct lwis_io_entry_modify mod;
 		struct lwis_io_entry_read_assert read_assert;
+		struct lwis_io_entry_poll_us poll_us;
 	};
 };
 
@@ -223,6 +263,7 @@ struct lwis_echo {
 #define LWIS_ERROR_EVENT_ID_MEMORY_PAGE_FAULT 2048
 #define LWIS_ERROR_EVENT_ID_SYSTEM_SUSPEND 2049
 #define LWIS_ERROR_EVENT_ID_EVENT_QUEUE_OVERFLOW 2050
+#define LWIS_ERROR_EVENT_ID_IRQ_STORM 2051
 // ...
 #define LWIS_EVENT_ID_START_OF_SPECIALIZED_RANGE 4096
 
@@ -319,6 +360,17 @@ struct lwis_periodic_io_info {
 	int64_t id;
 };
 
+struct lwis_periodic_io_anchored_info {
+	// Inputs and outputs, same as for PERIODIC_IO_SUBMIT
+	struct lwis_periodic_io_info info;
+	// Input
+	// The timer is re-phased on every occurrence of this event and fires
+	// trigger_offset_ns after it, then every period_ns until the next
+	// occurrence. LWIS_EVENT_ID_NONE keeps the free-running timer.
+	int64_t trigger_event_id;
+	int64_t trigger_offset_ns;
+};
+
 // Header of a periodic_io response as a payload of lwis_event_info
 // Actual size of this struct depends on batch_size and num_entries_per_period
 struct lwis_periodic_io_response_header {
@@ -356,6 +408,42 @@ struct lwis_qos_setting {
 	int64_t rt_bw;
 };
 
+struct lwis_allocator_reserve_entry {
+	// Size in bytes of the allocations the blocks are reserved for
+	size_t size;
+	// Number of free blocks to keep ready for allocations of that size
+	uint32_t num_blocks;
+};
+
+struct lwis_allocator_reserve_info {
+	size_t num_entries;
+	struct lwis_allocator_reserve_entry *entries;
+};
+
+enum lwis_cpu_affinity_target {
+	// Interrupt selected by index, its IRQ thread follows the same CPUs
+	LWIS_CPU_AFFINITY_IRQ = 0,
+	LWIS_CPU_AFFINITY_TRANSACTION_WORKER,
+	LWIS_CPU_AFFINITY_PERIODIC_IO_WORKER,
+	// Top device only
+	LWIS_CPU_AFFINITY_SUBSCRIBE_WORKER,
+};
+
+struct lwis_cpu_affinity {
+	// IOCTL Inputs
+	int32_t target;
+	// Interrupt index, for LWIS_CPU_AFFINITY_IRQ
+	int32_t index;
+	// CPUs to run on, one bit per CPU, 0 to only query the placement.
+	// Setting a placement needs CAP_SYS_NICE
+	uint64_t cpu_mask;
+	// IOCTL Outputs
+	// CPUs the target is allowed to run on
+	uint64_t effective_cpu_mask;
+	// CPU a worker last ran on, -1 for interrupts
+	int32_t last_cpu;
+};
+
 struct lwis_dpm_qos_requirements {
 	// qos entities from user.
 	struct lwis_qos_setting *qos_settings;
@@ -381,6 +469,10 @@ struct lwis_dpm_qos_requirements {
 #define LWIS_REG_IO _IOWR(LWIS_IOC_TYPE, 11, struct lwis_io_entries)
 #define LWIS_ECHO _IOWR(LWIS_IOC_TYPE, 12, struct lwis_echo)
 #define LWIS_DEVICE_RESET _IOWR(LWIS_IOC_TYPE, 13, struct lwis_io_entries)
+#define LWIS_ALLOCATOR_RESERVE _IOW(LWIS_IOC_TYPE, 14, struct lwis_allocator_reserve_info)
+#define LWIS_CPU_AFFINITY _IOWR(LWIS_IOC_TYPE, 15, struct lwis_cpu_affinity)
+#define LWIS_BUFFER_ENROLL_BATCH _IOWR(LWIS_IOC_TYPE, 16, struct lwis_buffer_enroll_batch)
+#define LWIS_BUFFER_DISENROLL_BATCH _IOWR(LWIS_IOC_TYPE, 17, struct lwis_buffer_disenroll_batch)
 
 #define LWIS_EVENT_CONTROL_GET _IOWR(LWIS_IOC_TYPE, 20, struct lwis_event_control)
 #define LWIS_EVENT_CONTROL_SET _IOW(LWIS_IOC_TYPE, 21, struct lwis_event_control_list)
@@ -392,6 +484,8 @@ struct lwis_dpm_qos_requirements {
 
 #define LWIS_PERIODIC_IO_SUBMIT _IOWR(LWIS_IOC_TYPE, 40, struct lwis_periodic_io_info)
 #define LWIS_PERIODIC_IO_CANCEL _IOWR(LWIS_IOC_TYPE, 41, int64_t)
+#define LWIS_PERIODIC_IO_SUBMIT_ANCHORED \
+	_IOWR(LWIS_IOC_TYPE, 42, struct lwis_periodic_io_anchored_info)
 
 #define LWIS_DPM_CLK_UPDATE _IOW(LWIS_IOC_TYPE, 50, struct lwis_dpm_clk_settings)
 #define LWIS_DPM_QOS_UPDATE _IOW(LWIS_IOC_TYPE, 51, struct lwis_dpm_qos_requirements)
@@ -407,6 +501,19 @@ struct lwis_mem_page_fault_event_payload {
 	uint64_t fault_flags;
 };
 
+/* For LWIS_ERROR_EVENT_ID_IRQ_STORM */
+struct lwis_irq_storm_event_payload {
+	// Status bits masked for exceeding their budget
+	uint64_t int_reg_bits;
+	// Enabled event on the lowest of those bits, 0 if none
+	int64_t event_id;
+	// Budget: threshold interrupts per window_ms
+	uint32_t threshold;
+	uint32_t window_ms;
+	// Time the bits stay masked
+	uint32_t cooldown_ms;
+};
+
 #pragma pack(pop)
 
 #ifdef __cplusplus
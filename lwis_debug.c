@@ -12,12 +12,17 @@
 #include <linux/fs.h>
 #include <linux/hashtable.h>
 #include <linux/list.h>
+#include <linux/math64.h>
 #include <linux/string.h>
 
+#include "lwis_allocator.h"
 #include "lwis_buffer.h"
 #include "lwis_debug.h"
 #include "lwis_device.h"
+#include "lwis_device_i2c.h"
 #include "lwis_event.h"
+#include "lwis_interrupt.h"
+#include "lwis_ioreg.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
 
@@ -164,6 +169,17 @@ static void list_enrolled_buffers(struct lwis_client *client, char *k_buf, size_
 	}
 }
 
+static void list_cached_buffer_mappings(struct lwis_client *client, char *k_buf,
+				       size_t k_buf_size)
+{
+	char tmp_buf[64] = {};
+
+	scnprintf(tmp_buf, sizeof(tmp_buf), "Cached buffer mappings: %d/%d (%zu bytes)\n",
+		  client->num_buffer_mappings, LWIS_BUFFER_MAPPING_CACHE_SIZE,
+		  client->buffer_mapping_bytes);
+	strlcat(k_buf, tmp_buf, k_buf_size);
+}
+
 static int generate_device_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
 {
 	if (lwis_dev == NULL) {
@@ -288,6 +304,7 @@ static int generate_buffer_info(struct lwis_device *lwis_dev, char *buffer, size
 		strlcat(buffer, tmp_buf, buffer_size);
 		list_allocated_buffers(client, buffer, buffer_size);
 		list_enrolled_buffers(client, buffer, buffer_size);
+		list_cached_buffer_mappings(client, buffer, buffer_size);
 		idx++;
 	}
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
@@ -380,6 +397,80 @@ exit:
 /* DebugFS specific functions */
 #ifdef CONFIG_DEBUG_FS
 
+static int generate_allocator_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+{
+	/* Temporary buffer to be concatenated to the main buffer. */
+	char tmp_buf[192] = {};
+	struct lwis_allocator_pool_stats *stats;
+	int i;
+
+	if (lwis_dev == NULL) {
+		pr_err("Unknown LWIS device pointer\n");
+		return -EINVAL;
+	}
+
+	scnprintf(buffer, buffer_size, "=== LWIS ALLOCATOR INFO: %s ===\n", lwis_dev->name);
+
+	stats = kmalloc_array(LWIS_ALLOCATOR_NUM_STATS, sizeof(*stats), GFP_KERNEL);
+	if (!stats) {
+		return -ENOMEM;
+	}
+
+	if (lwis_allocator_get_stats(lwis_dev, stats)) {
+		strlcat(buffer, "Allocator not initialized\n", buffer_size);
+		kfree(stats);
+		return 0;
+	}
+
+	for (i = 0; i < LWIS_ALLOCATOR_NUM_STATS; i++) {
+		scnprintf(tmp_buf, sizeof(tmp_buf),
+			  "%s: Allocs %llu Hits %llu Misses %llu Cached %u (%zu bytes) "
+			  "InUse %u PeakInUse %u Watermarks %u/%u\n",
+			  stats[i].name, stats[i].alloc_count, stats[i].hit_count,
+			  stats[i].miss_count, stats[i].cached_count, stats[i].cached_bytes,
+			  stats[i].in_use_count, stats[i].peak_in_use_count,
+			  stats[i].low_watermark, stats[i].high_watermark);
+		strlcat(buffer, tmp_buf, buffer_size);
+	}
+
+	kfree(stats);
+	return 0;
+}
+
+static int generate_i2c_bus_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+{
+	struct lwis_i2c_device *i2c_dev;
+	struct lwis_i2c_sched_stats stats;
+
+	if (lwis_dev == NULL) {
+		pr_err("Unknown LWIS device pointer\n");
+		return -EINVAL;
+	}
+	if (lwis_dev->type != DEVICE_TYPE_I2C) {
+		return -EINVAL;
+	}
+	i2c_dev = container_of(lwis_dev, struct lwis_i2c_device, base_dev);
+
+	scnprintf(buffer, buffer_size, "=== LWIS I2C BUS INFO: %s ===\n", lwis_dev->name);
+	if (i2c_dev->bus_sched == NULL) {
+		strlcat(buffer, "Not in an i2c lock group\n", buffer_size);
+		return 0;
+	}
+
+	lwis_i2c_sched_get_stats(i2c_dev->bus_sched, &stats);
+	scnprintf(buffer + strlen(buffer), buffer_size - strlen(buffer),
+		  "Group %u Priority %u\n"
+		  "Requests %llu Waited %llu Back to back %llu Aged %llu\n"
+		  "Wait total %llu ns max %llu ns avg %llu ns\n"
+		  "Queue depth %u max %u\n",
+		  i2c_dev->i2c_lock_group_id, i2c_dev->transfer_priority, stats.request_count,
+		  stats.wait_count, stats.back_to_back_count, stats.aged_count, stats.total_wait_ns,
+		  stats.max_wait_ns,
+		  stats.wait_count ? div64_u64(stats.total_wait_ns, stats.wait_count) : 0,
+		  stats.queue_depth, stats.max_queue_depth);
+	return 0;
+}
+
 static ssize_t dev_info_read(struct file *fp, char __user *user_buf, size_t count, loff_t *position)
 {
 	int ret = 0;
@@ -471,6 +562,101 @@ exit:
 	return ret;
 }
 
+static ssize_t allocator_info_read(struct file *fp, char __user *user_buf, size_t count,
+				   loff_t *position)
+{
+	int ret = 0;
+	/* Buffer to store information */
+	const size_t buffer_size = 2048;
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
+	if (!buffer) {
+		dev_err(lwis_dev->dev, "Failed to allocate allocator info log buffer\n");
+		return -ENOMEM;
+	}
+
+	ret = generate_allocator_info(lwis_dev, buffer, buffer_size);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to generate allocator info\n");
+		goto exit;
+	}
+
+	ret = simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
+exit:
+	kfree(buffer);
+	return ret;
+}
+
+static ssize_t i2c_bus_info_read(struct file *fp, char __user *user_buf, size_t count,
+				 loff_t *position)
+{
+	int ret = 0;
+	/* Buffer to store information */
+	char buffer[512] = {};
+	const size_t buffer_size = sizeof(buffer);
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+
+	ret = generate_i2c_bus_info(lwis_dev, buffer, buffer_size);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to generate i2c bus info\n");
+		return ret;
+	}
+
+	return simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
+}
+
+static ssize_t irq_storm_info_read(struct file *fp, char __user *user_buf, size_t count,
+				   loff_t *position)
+{
+	int ret = 0;
+	/* Buffer to store information */
+	const size_t buffer_size = 4096;
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
+	if (!buffer) {
+		dev_err(lwis_dev->dev, "Failed to allocate IRQ storm info log buffer\n");
+		return -ENOMEM;
+	}
+
+	lwis_interrupt_storm_info(lwis_dev->irqs, buffer, buffer_size);
+
+	ret = simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
+	kfree(buffer);
+	return ret;
+}
+
+static ssize_t ioreg_batch_benchmark_read(struct file *fp, char __user *user_buf, size_t count,
+					  loff_t *position)
+{
+	int ret = 0;
+	/* Buffer to store information */
+	const size_t buffer_size = 1024;
+	char *buffer;
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+
+	/* Only run the benchmark once per read() sequence */
+	if (*position > 0) {
+		return 0;
+	}
+
+	buffer = kzalloc(buffer_size, GFP_KERNEL);
+	if (!buffer) {
+		dev_err(lwis_dev->dev, "Failed to allocate ioreg batch benchmark buffer\n");
+		return -ENOMEM;
+	}
+
+	ret = lwis_ioreg_batch_benchmark(buffer, buffer_size);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to run ioreg batch benchmark\n");
+		goto exit;
+	}
+
+	ret = simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
+exit:
+	kfree(buffer);
+	return ret;
+}
+
 static struct file_operations dev_info_fops = {
 	.owner = THIS_MODULE,
 	.read = dev_info_read,
@@ -491,6 +677,26 @@ static struct file_operations buffer_info_fops = {
 	.read = buffer_info_read,
 };
 
+static struct file_operations allocator_info_fops = {
+	.owner = THIS_MODULE,
+	.read = allocator_info_read,
+};
+
+static struct file_operations i2c_bus_info_fops = {
+	.owner = THIS_MODULE,
+	.read = i2c_bus_info_read,
+};
+
+static struct file_operations irq_storm_info_fops = {
+	.owner = THIS_MODULE,
+	.read = irq_storm_info_read,
+};
+
+static struct file_operations ioreg_batch_benchmark_fops = {
+	.owner = THIS_MODULE,
+	.read = ioreg_batch_benchmark_read,
+};
+
 int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_root)
 {
 	struct dentry *dbg_dir;
@@ -498,6 +704,10 @@ int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_r
 	struct dentry *dbg_event_file;
 	struct dentry *dbg_transaction_file;
 	struct dentry *dbg_buffer_file;
+	struct dentry *dbg_allocator_file;
+	struct dentry *dbg_i2c_bus_file = NULL;
+	struct dentry *dbg_ioreg_benchmark_file = NULL;
+	struct dentry *dbg_irq_storm_file = NULL;
 
 	/* DebugFS not present, just return */
 	if (dbg_root == NULL) {
@@ -543,11 +753,53 @@ int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_r
 		dbg_buffer_file = NULL;
 	}
 
+	dbg_allocator_file = debugfs_create_file("allocator_info", 0444, dbg_dir, lwis_dev,
+						 &allocator_info_fops);
+	if (IS_ERR_OR_NULL(dbg_allocator_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS allocator_info - %ld",
+			 PTR_ERR(dbg_allocator_file));
+		dbg_allocator_file = NULL;
+	}
+
+	if (lwis_dev->type == DEVICE_TYPE_I2C) {
+		dbg_i2c_bus_file = debugfs_create_file("i2c_bus_info", 0444, dbg_dir, lwis_dev,
+						       &i2c_bus_info_fops);
+		if (IS_ERR_OR_NULL(dbg_i2c_bus_file)) {
+			dev_warn(lwis_dev->dev, "Failed to create DebugFS i2c_bus_info - %ld",
+				 PTR_ERR(dbg_i2c_bus_file));
+			dbg_i2c_bus_file = NULL;
+		}
+	}
+
+	if (lwis_dev->type == DEVICE_TYPE_IOREG) {
+		dbg_ioreg_benchmark_file = debugfs_create_file(
+			"ioreg_batch_benchmark", 0400, dbg_dir, lwis_dev, &ioreg_batch_benchmark_fops);
+		if (IS_ERR_OR_NULL(dbg_ioreg_benchmark_file)) {
+			dev_warn(lwis_dev->dev, "Failed to create DebugFS ioreg_batch_benchmark - %ld",
+				 PTR_ERR(dbg_ioreg_benchmark_file));
+			dbg_ioreg_benchmark_file = NULL;
+		}
+	}
+
+	if (lwis_dev->irqs) {
+		dbg_irq_storm_file = debugfs_create_file("irq_storm_info", 0444, dbg_dir, lwis_dev,
+							 &irq_storm_info_fops);
+		if (IS_ERR_OR_NULL(dbg_irq_storm_file)) {
+			dev_warn(lwis_dev->dev, "Failed to create DebugFS irq_storm_info - %ld",
+				 PTR_ERR(dbg_irq_storm_file));
+			dbg_irq_storm_file = NULL;
+		}
+	}
+
 	lwis_dev->dbg_dir = dbg_dir;
 	lwis_dev->dbg_dev_info_file = dbg_dev_info_file;
 	lwis_dev->dbg_event_file = dbg_event_file;
 	lwis_dev->dbg_transaction_file = dbg_transaction_file;
 	lwis_dev->dbg_buffer_file = dbg_buffer_file;
+	lwis_dev->dbg_allocator_file = dbg_allocator_file;
+	lwis_dev->dbg_i2c_bus_file = dbg_i2c_bus_file;
+	lwis_dev->dbg_ioreg_benchmark_file = dbg_ioreg_benchmark_file;
+	lwis_dev->dbg_irq_storm_file = dbg_irq_storm_file;
 
 	return 0;
 }
@@ -564,6 +816,10 @@ int lwis_device_debugfs_cleanup(struct lwis_device *lwis_dev)
 	lwis_dev->dbg_event_file = NULL;
 	lwis_dev->dbg_transaction_file = NULL;
 	lwis_dev->dbg_buffer_file = NULL;
+	lwis_dev->dbg_allocator_file = NULL;
+	lwis_dev->dbg_i2c_bus_file = NULL;
+	lwis_dev->dbg_ioreg_benchmark_file = NULL;
+	lwis_dev->dbg_irq_storm_file = NULL;
 	return 0;
 }
 
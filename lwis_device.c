@@ -31,6 +31,7 @@
 #include "lwis_dt.h"
 #include "lwis_event.h"
 #include "lwis_gpio.h"
+#include "lwis_i2c.h"
 #include "lwis_init.h"
 #include "lwis_ioctl.h"
 #include "lwis_periodic_io.h"
@@ -60,6 +61,7 @@ static int lwis_release(struct inode *node, struct file *fp);
 static long lwis_ioctl(struct file *fp, unsigned int type, unsigned long param);
 static unsigned int lwis_poll(struct file *fp, poll_table *wait);
 static ssize_t lwis_read(struct file *fp, char __user *user_buf, size_t count, loff_t *pos);
+static int lwis_mmap(struct file *fp, struct vm_area_struct *vma);
 
 static struct file_operations lwis_fops = {
 	.owner = THIS_MODULE,
@@ -68,6 +70,7 @@ static struct file_operations lwis_fops = {
 	.unlocked_ioctl = lwis_ioctl,
 	.poll = lwis_poll,
 	.read = lwis_read,
+	.mmap = lwis_mmap,
 };
 
 /*
@@ -117,6 +120,12 @@ static int lwis_open(struct inode *node, struct file *fp)
 	/* Empty hash table for client enrolled buffers */
 	hash_init(lwis_client->enrolled_buffers);
 
+	/* Empty cache of idle buffer mappings */
+	hash_init(lwis_client->buffer_mappings);
+	INIT_LIST_HEAD(&lwis_client->buffer_mapping_lru);
+	lwis_client->num_buffer_mappings = 0;
+	lwis_client->buffer_mapping_bytes = 0;
+
 	/* Initialize the allocator */
 	lwis_allocator_init(lwis_dev);
 
@@ -262,6 +271,27 @@ static int lwis_release(struct inode *node, struct file *fp)
 	return rc;
 }
 
+/*
+ *  lwis_mmap: Map device memory into the address space of a client
+ */
+static int lwis_mmap(struct file *fp, struct vm_area_struct *vma)
+{
+	struct lwis_client *lwis_client = fp->private_data;
+	struct lwis_device *lwis_dev;
+
+	if (!lwis_client) {
+		pr_err("Cannot find client instance\n");
+		return -ENODEV;
+	}
+
+	lwis_dev = lwis_client->lwis_dev;
+	if (lwis_dev->vops.mmap == NULL) {
+		return -ENODEV;
+	}
+
+	return lwis_dev->vops.mmap(lwis_dev, fp, vma);
+}
+
 /*
  *  lwis_ioctl: I/O control function on a LWIS device
  *
@@ -716,6 +746,9 @@ int lwis_dev_power_up_locked(struct lwis_device *lwis_dev)
 		}
 	}
 
+	/* IRQ mask registers are back to their reset values, reload on next use */
+	lwis_interrupt_mask_shadow_invalidate(lwis_dev->irqs);
+
 	/* Sleeping to make sure all pins are ready to go */
 	usleep_range(2000, 2000);
 	return 0;
@@ -975,6 +1008,9 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 		}
 	}
 
+	/* IRQ mask registers lose their contents once powered off */
+	lwis_interrupt_mask_shadow_invalidate(lwis_dev->irqs);
+
 	if (lwis_dev->phys) {
 		/* Power on the PHY */
 		ret = lwis_phy_set_power_all(lwis_dev->phys,
@@ -1135,6 +1171,20 @@ struct lwis_device *lwis_find_dev_by_id(int dev_id)
 	return NULL;
 }
 
+/*
+ *  lwis_for_each_dev: Call fn on every LWIS device.
+ */
+void lwis_for_each_dev(void (*fn)(struct lwis_device *lwis_dev, void *data), void *data)
+{
+	struct lwis_device *lwis_dev;
+
+	mutex_lock(&core.lock);
+	list_for_each_entry (lwis_dev, &core.lwis_dev_list, dev_list) {
+		fn(lwis_dev, data);
+	}
+	mutex_unlock(&core.lock);
+}
+
 /*
  *  lwis_i2c_dev_is_in_use: Check i2c device is in use.
  */
@@ -1210,6 +1260,10 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
 	/* Initialize event state hash table */
 	hash_init(lwis_dev->event_states);
 
+	/* Initialize event subscriber hash table */
+	hash_init(lwis_dev->event_subscribers);
+	mutex_init(&lwis_dev->subscribe_lock);
+
 	/* Initialize the spinlock */
 	spin_lock_init(&lwis_dev->lock);
 
@@ -1274,6 +1328,14 @@ void lwis_base_unprobe(struct lwis_device *unprobe_lwis_dev)
 {
 	struct lwis_device *lwis_dev, *temp;
 
+	/* Release the subscription table of the device, before it is freed by its
+	 * caller. The top device releases every table itself. This waits for the
+	 * subscribe work, so it cannot run under core.lock. */
+	if (unprobe_lwis_dev->top_dev && unprobe_lwis_dev->type != DEVICE_TYPE_TOP) {
+		unprobe_lwis_dev->top_dev->subscribe_ops.release_trigger(
+			unprobe_lwis_dev->top_dev, unprobe_lwis_dev);
+	}
+
 	mutex_lock(&core.lock);
 	list_for_each_entry_safe (lwis_dev, temp, &core.lwis_dev_list, dev_list) {
 		if (lwis_dev == unprobe_lwis_dev) {
@@ -1529,6 +1591,8 @@ static void __exit lwis_driver_exit(void)
 			struct lwis_i2c_device *i2c_dev;
 			i2c_dev = container_of(lwis_dev, struct lwis_i2c_device, base_dev);
 			i2c_unregister_device(i2c_dev->client);
+			lwis_i2c_reg_cache_free(i2c_dev);
+			lwis_i2c_xfer_buffers_free(i2c_dev);
 		}
 		/* Relase each client registered with dev */
 		list_for_each_entry_safe (client, client_temp, &lwis_dev->clients, node) {
@@ -1584,6 +1648,9 @@ static void __exit lwis_driver_exit(void)
 		/* Release event subscription components */
 		if (lwis_dev->type == DEVICE_TYPE_TOP) {
 			lwis_dev->top_dev->subscribe_ops.release(lwis_dev);
+		} else if (lwis_dev->top_dev) {
+			lwis_dev->top_dev->subscribe_ops.release_trigger(lwis_dev->top_dev,
+									 lwis_dev);
 		}
 
 		/* Destroy device */
@@ -51,6 +51,9 @@ struct lwis_device;
 /* Forward declaration of a platform specific struct used by platform funcs */
 struct lwis_platform;
 
+/* Number of recycling block pools, from 8K (2^13) to 512K (2^19) */
+#define LWIS_ALLOCATOR_NUM_POOLS 7
+
 /* Forward declaration of lwis allocator block manager */
 struct lwis_allocator_block_mgr;
 int lwis_allocator_init(struct lwis_device *lwis_dev);
@@ -81,6 +84,21 @@ struct lwis_device_subclass_operations {
 	/* Called by lwis_device when device register needs to be read/written */
 	int (*register_io)(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 			   int access_size);
+	/* Called by lwis_device when a run of LWIS_IO_ENTRY_WRITE entries needs to
+	 * be written. Sets *num_written to the number of leading entries known to
+	 * have reached the device. NULL if they can only be written one by one */
+	int (*register_io_multi_write)(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				       int num_entries, int access_size, int *num_written);
+	/* Called by lwis_device when a run of LWIS_IO_ENTRY_WRITE, _WRITE_BATCH and
+	 * _MODIFY entries needs to be processed. Sets *num_processed to the number
+	 * of leading entries handled, which stops short of any entry that does not
+	 * validate and includes one that failed. NULL if entries can only be
+	 * processed one by one */
+	int (*register_io_multi)(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				 int num_entries, int access_size, int *num_processed);
+	/* Called by lwis_device when a client maps the device into its address
+	 * space, NULL if mmap is not supported */
+	int (*mmap)(struct lwis_device *lwis_dev, struct file *fp, struct vm_area_struct *vma);
 	/* Called by lwis_device when a read/write memory barrier needs to be inserted */
 	int (*register_io_barrier)(struct lwis_device *lwis_dev, bool use_read_barrier,
 				   bool use_write_barrier);
@@ -115,12 +133,15 @@ struct lwis_event_subscribe_operations {
 	/* Unsubscribe an event for subscriber device */
 	int (*unsubscribe_event)(struct lwis_device *lwis_dev, int64_t trigger_event_id,
 				 int subscriber_device_id);
-	/* Notify subscriber when an event is happening */
-	void (*notify_event_subscriber)(struct lwis_device *lwis_dev, int64_t trigger_event_id,
+	/* Notify subscriber when an event of trigger_dev is happening */
+	void (*notify_event_subscriber)(struct lwis_device *lwis_dev,
+					struct lwis_device *trigger_dev, int64_t trigger_event_id,
 					int64_t trigger_event_count,
 					int64_t trigger_event_timestamp, bool in_irq);
-	/* Clean up event subscription hash table when unloading top device */
+	/* Clean up event subscription hash tables when unloading top device */
 	void (*release)(struct lwis_device *lwis_dev);
+	/* Clean up the subscription hash table of trigger_dev when destroying it */
+	void (*release_trigger)(struct lwis_device *lwis_dev, struct lwis_device *trigger_dev);
 };
 
 /*
@@ -200,6 +221,11 @@ struct lwis_device {
 	struct list_head clients;
 	/* Hash table of device-specific per-event state/control data */
 	DECLARE_HASHTABLE(event_states, EVENT_HASH_BITS);
+	/* Subscribers to this device's events, keyed by trigger event id. RCU
+	 * protected, managed by the top device */
+	DECLARE_HASHTABLE(event_subscribers, EVENT_HASH_BITS);
+	/* Serializes changes to event_subscribers */
+	struct mutex subscribe_lock;
 	/* Virtual function table for sub classes */
 	struct lwis_device_subclass_operations vops;
 	/* Heartbeat timer structure */
@@ -217,6 +243,10 @@ struct lwis_device {
 	struct dentry *dbg_event_file;
 	struct dentry *dbg_transaction_file;
 	struct dentry *dbg_buffer_file;
+	struct dentry *dbg_allocator_file;
+	struct dentry *dbg_i2c_bus_file;
+	struct dentry *dbg_ioreg_benchmark_file;
+	struct dentry *dbg_irq_storm_file;
 #endif
 	/* Structure to store info to help debugging device data */
 	struct lwis_device_debug_info debug_info;
@@ -248,9 +278,18 @@ struct lwis_device {
 
 	/* Is device read only */
 	bool is_read_only;
+	/* Receive subscribed events in the trigger device's context rather
+	 * than from the top device's subscribe worker, IOREG devices only */
+	bool direct_event_delivery;
 	/* Adjust thread priority */
 	u32 transaction_thread_priority;
 	u32 periodic_io_thread_priority;
+	/* CPUs the worker threads are pinned to, one bit per CPU, 0 to float */
+	u64 transaction_thread_cpu_mask;
+	u64 periodic_io_thread_cpu_mask;
+	u64 subscribe_thread_cpu_mask;
+	/* Number of blocks reserved in each allocator pool at init */
+	u32 allocator_reserve_blocks[LWIS_ALLOCATOR_NUM_POOLS];
 
 	/* LWIS allocator block manager */
 	struct lwis_allocator_block_mgr *block_mgr;
@@ -287,6 +326,13 @@ struct lwis_client {
 	DECLARE_HASHTABLE(allocated_buffers, BUFFER_HASH_BITS);
 	/* Hash table of enrolled buffers keyed by dvaddr */
 	DECLARE_HASHTABLE(enrolled_buffers, BUFFER_HASH_BITS);
+	/* Free blocks this client asked each allocator pool to keep */
+	u32 allocator_reserve_blocks[LWIS_ALLOCATOR_NUM_POOLS];
+	/* Hash table of idle buffer mappings keyed by dma_buf, and their LRU order */
+	DECLARE_HASHTABLE(buffer_mappings, BUFFER_HASH_BITS);
+	struct list_head buffer_mapping_lru;
+	int num_buffer_mappings;
+	size_t buffer_mapping_bytes;
 	/* Hash table of transactions keyed by trigger event ID */
 	DECLARE_HASHTABLE(transaction_list, TRANSACTION_HASH_BITS);
 	/* Spinlock used to synchronize access to transaction data structs */
@@ -297,6 +343,8 @@ struct lwis_client {
 	int64_t transaction_counter;
 	/* Hash table of hrtimer keyed by time out duration */
 	DECLARE_HASHTABLE(timer_list, PERIODIC_IO_HASH_BITS);
+	/* Timers in timer_list that are re-phased by a trigger event */
+	struct list_head anchored_timer_list;
 	/* Work item */
 	struct kthread_work transaction_work;
 	struct kthread_work periodic_io_work;
@@ -330,6 +378,11 @@ void lwis_base_unprobe(struct lwis_device *unprobe_lwis_dev);
  */
 struct lwis_device *lwis_find_dev_by_id(int dev_id);
 
+/*
+ * Call fn on every LWIS device, with the device list locked
+ */
+void lwis_for_each_dev(void (*fn)(struct lwis_device *lwis_dev, void *data), void *data);
+
 /*
  * Check i2c device is still in use:
  * Check if there is any other device using the same I2C bus.
@@ -23,6 +23,9 @@
 
 static struct lwis_device_subclass_operations dpm_vops = {
 	.register_io = NULL,
+	.register_io_multi_write = NULL,
+	.register_io_multi = NULL,
+	.mmap = NULL,
 	.register_io_barrier = NULL,
 	.device_enable = NULL,
 	.device_disable = NULL,
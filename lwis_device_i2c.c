@@ -41,14 +41,21 @@
 #define I2C_OFF_STRING "off_i2c"
 
 static struct mutex group_i2c_lock[MAX_I2C_LOCK_NUM];
+static struct lwis_i2c_sched group_i2c_sched[MAX_I2C_LOCK_NUM];
 
 static int lwis_i2c_device_enable(struct lwis_device *lwis_dev);
 static int lwis_i2c_device_disable(struct lwis_device *lwis_dev);
 static int lwis_i2c_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				int access_size);
+static int lwis_i2c_register_io_multi_write(struct lwis_device *lwis_dev,
+					    struct lwis_io_entry *entries, int num_entries,
+					    int access_size, int *num_written);
 
 static struct lwis_device_subclass_operations i2c_vops = {
 	.register_io = lwis_i2c_register_io,
+	.register_io_multi_write = lwis_i2c_register_io_multi_write,
+	.register_io_multi = NULL,
+	.mmap = NULL,
 	.register_io_barrier = NULL,
 	.device_enable = lwis_i2c_device_enable,
 	.device_disable = lwis_i2c_device_disable,
@@ -99,6 +106,9 @@ static int lwis_i2c_device_disable(struct lwis_device *lwis_dev)
 	struct lwis_i2c_device *i2c_dev;
 	i2c_dev = container_of(lwis_dev, struct lwis_i2c_device, base_dev);
 
+	/* Register values are lost once the device is powered down */
+	lwis_i2c_reg_cache_invalidate(i2c_dev);
+
 #if IS_ENABLED(CONFIG_INPUT_STMVL53L1)
 	if (is_shared_i2c_with_stmvl53l1(i2c_dev->state_pinctrl)) {
 		/* Disable the shared i2c bus */
@@ -142,6 +152,21 @@ static int lwis_i2c_register_io(struct lwis_device *lwis_dev, struct lwis_io_ent
 	return lwis_i2c_io_entry_rw(i2c_dev, entry);
 }
 
+static int lwis_i2c_register_io_multi_write(struct lwis_device *lwis_dev,
+					    struct lwis_io_entry *entries, int num_entries,
+					    int access_size, int *num_written)
+{
+	struct lwis_i2c_device *i2c_dev;
+	i2c_dev = container_of(lwis_dev, struct lwis_i2c_device, base_dev);
+
+	*num_written = 0;
+	/* Running in interrupt context is not supported as i2c driver might sleep */
+	if (in_interrupt()) {
+		return -EAGAIN;
+	}
+	return lwis_i2c_io_entries_write(i2c_dev, entries, num_entries, num_written);
+}
+
 static int lwis_i2c_addr_matcher(struct device *dev, void *data)
 {
 	struct i2c_client *client = i2c_verify_client(dev);
@@ -178,6 +203,27 @@ static int lwis_i2c_device_setup(struct lwis_i2c_device *i2c_dev)
 
 	/* Initialize device i2c lock */
 	i2c_dev->group_i2c_lock = &group_i2c_lock[i2c_dev->i2c_lock_group_id];
+	mutex_init(&i2c_dev->io_lock);
+
+	/* The default group gathers devices from unrelated buses, only schedule
+	   the register accesses of devices sharing an explicit group */
+	if (i2c_dev->i2c_lock_group_id < MAX_I2C_LOCK_NUM - 1) {
+		i2c_dev->bus_sched = &group_i2c_sched[i2c_dev->i2c_lock_group_id];
+	} else {
+		i2c_dev->bus_sched = NULL;
+	}
+
+	ret = lwis_i2c_xfer_buffers_alloc(i2c_dev);
+	if (ret) {
+		dev_err(i2c_dev->base_dev.dev, "Failed to allocate i2c transfer buffers\n");
+		return ret;
+	}
+
+	ret = lwis_i2c_reg_cache_alloc(i2c_dev);
+	if (ret) {
+		dev_err(i2c_dev->base_dev.dev, "Failed to allocate i2c register cache\n");
+		return ret;
+	}
 
 	info.addr = i2c_dev->address;
 
@@ -303,6 +349,8 @@ static int lwis_i2c_device_probe(struct platform_device *plat_dev)
 	return 0;
 
 error_probe:
+	lwis_i2c_reg_cache_free(i2c_dev);
+	lwis_i2c_xfer_buffers_free(i2c_dev);
 	kfree(i2c_dev);
 	return ret;
 }
@@ -428,6 +476,7 @@ int __init lwis_i2c_device_init(void)
 
 	for (i = 0; i < MAX_I2C_LOCK_NUM; ++i) {
 		mutex_init(&group_i2c_lock[i]);
+		lwis_i2c_sched_init(&group_i2c_sched[i]);
 	}
 
 	return ret;
@@ -15,9 +15,32 @@
 #include <linux/pinctrl/consumer.h>
 
 #include "lwis_device.h"
+#include "lwis_i2c_sched.h"
 
 #define MAX_I2C_LOCK_NUM 8
 
+/* Default size of the largest batch write payload that goes through the
+   preallocated transfer buffer */
+#define LWIS_I2C_DEFAULT_MAX_BATCH_SIZE 256
+
+/* Largest number of registers the shadow cache can hold for a device */
+#define LWIS_I2C_REG_CACHE_MAX_REGS 65536
+
+/* Range of register offsets, both ends included */
+struct lwis_i2c_reg_range {
+	u32 start;
+	u32 end;
+};
+
+/* Shadow copy of the registers in a cacheable range */
+struct lwis_i2c_reg_cache_block {
+	struct lwis_i2c_reg_range range;
+	/* Last value written to or read from each register */
+	u32 *values;
+	/* Bitmap of the registers whose value is known */
+	unsigned long *valid;
+};
+
 /*
  *  struct lwis_i2c_device
  *  "Derived" lwis_device struct, with added i2c related elements.
@@ -33,6 +56,38 @@ struct lwis_i2c_device {
 	u32 i2c_lock_group_id;
 	/* Mutex shared by the same group id's I2C devices */
 	struct mutex *group_i2c_lock;
+	/* Transfer scheduler shared by the same group id's I2C devices, NULL
+	   for devices that are not in a lock group */
+	struct lwis_i2c_sched *bus_sched;
+	/* Priority of this device's register accesses in the group */
+	u32 transfer_priority;
+	/* Serializes register access and the use of the transfer buffers */
+	struct mutex io_lock;
+	/* Largest batch write payload that fits in xfer_wbuf */
+	u32 max_batch_size;
+	/* Preallocated DMA-safe buffers holding the offset and value bytes */
+	u8 *xfer_wbuf;
+	u8 *xfer_rbuf;
+	/* Pack runs of register writes into multi-message transfers */
+	bool batch_writes;
+	/* Messages of the multi-message transfers */
+	struct i2c_msg *xfer_msgs;
+	int num_xfer_msgs;
+	/* Number of single register writes that fit in xfer_wbuf */
+	int max_write_msgs;
+	/* Fixed-offset batches can be streamed in one transfer, the device does
+	   not auto-increment on its FIFO registers */
+	bool fifo_streaming;
+	/* Batches are split so that no transfer crosses a page, 0 if unpaged */
+	u32 page_size;
+	/* Register shadow cache, empty unless cacheable ranges are defined */
+	struct lwis_i2c_reg_cache_block *reg_cache;
+	int num_reg_cache_blocks;
+	/* Registers that must always be accessed on the bus */
+	struct lwis_i2c_reg_range *volatile_regs;
+	int num_volatile_regs;
+	/* Skip register writes that would not change the cached value */
+	bool reg_cache_skip_redundant_writes;
 };
 
 int lwis_i2c_device_deinit(void);
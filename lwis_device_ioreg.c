@@ -36,10 +36,18 @@ static int lwis_ioreg_device_enable(struct lwis_device *lwis_dev);
 static int lwis_ioreg_device_disable(struct lwis_device *lwis_dev);
 static int lwis_ioreg_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				  int access_size);
+static int lwis_ioreg_register_io_multi(struct lwis_device *lwis_dev,
+					struct lwis_io_entry *entries, int num_entries,
+					int access_size, int *num_processed);
 static int lwis_ioreg_register_io_barrier(struct lwis_device *lwis_dev, bool read, bool write);
+static int lwis_ioreg_mmap_dev(struct lwis_device *lwis_dev, struct file *fp,
+			       struct vm_area_struct *vma);
 
 static struct lwis_device_subclass_operations ioreg_vops = {
 	.register_io = lwis_ioreg_register_io,
+	.register_io_multi_write = NULL,
+	.register_io_multi = lwis_ioreg_register_io_multi,
+	.mmap = lwis_ioreg_mmap_dev,
 	.register_io_barrier = lwis_ioreg_register_io_barrier,
 	.device_enable = lwis_ioreg_device_enable,
 	.device_disable = lwis_ioreg_device_disable,
@@ -57,11 +65,13 @@ static struct lwis_event_subscribe_operations ioreg_subscribe_ops = {
 
 static int lwis_ioreg_device_enable(struct lwis_device *lwis_dev)
 {
+	lwis_ioreg_mmap_set_active((struct lwis_ioreg_device *)lwis_dev, true);
 	return 0;
 }
 
 static int lwis_ioreg_device_disable(struct lwis_device *lwis_dev)
 {
+	lwis_ioreg_mmap_set_active((struct lwis_ioreg_device *)lwis_dev, false);
 	return 0;
 }
 
@@ -71,6 +81,20 @@ static int lwis_ioreg_register_io(struct lwis_device *lwis_dev, struct lwis_io_e
 	return lwis_ioreg_io_entry_rw((struct lwis_ioreg_device *)lwis_dev, entry, access_size);
 }
 
+static int lwis_ioreg_register_io_multi(struct lwis_device *lwis_dev,
+					struct lwis_io_entry *entries, int num_entries,
+					int access_size, int *num_processed)
+{
+	return lwis_ioreg_io_entries_rw((struct lwis_ioreg_device *)lwis_dev, entries,
+					num_entries, access_size, num_processed);
+}
+
+static int lwis_ioreg_mmap_dev(struct lwis_device *lwis_dev, struct file *fp,
+			       struct vm_area_struct *vma)
+{
+	return lwis_ioreg_mmap((struct lwis_ioreg_device *)lwis_dev, fp, vma);
+}
+
 static int lwis_ioreg_register_io_barrier(struct lwis_device *lwis_dev, bool use_read_barrier,
 					  bool use_write_barrier)
 {
@@ -108,6 +132,9 @@ static int lwis_ioreg_device_probe(struct platform_device *plat_dev)
 		return -ENOMEM;
 	}
 
+	mutex_init(&ioreg_dev->mmap_lock);
+	INIT_LIST_HEAD(&ioreg_dev->mmap_list);
+
 	ioreg_dev->base_dev.type = DEVICE_TYPE_IOREG;
 	ioreg_dev->base_dev.vops = ioreg_vops;
 	ioreg_dev->base_dev.subscribe_ops = ioreg_subscribe_ops;
@@ -11,6 +11,8 @@
 #ifndef LWIS_DEVICE_IOREG_H_
 #define LWIS_DEVICE_IOREG_H_
 
+#include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/types.h>
 
 #include "lwis_device.h"
@@ -20,6 +22,8 @@ struct lwis_ioreg {
 	int size;
 	void __iomem *base;
 	char *name;
+	/* Whether clients may map this block read-only into userspace */
+	bool mmap_allowed;
 };
 
 struct lwis_ioreg_list {
@@ -34,6 +38,12 @@ struct lwis_ioreg_list {
 struct lwis_ioreg_device {
 	struct lwis_device base_dev;
 	struct lwis_ioreg_list reg_list;
+	/* Protects mmap_active and mmap_list */
+	struct mutex mmap_lock;
+	/* Userspace mappings only resolve to registers while the device is enabled */
+	bool mmap_active;
+	/* Live userspace mappings of register blocks, revoked on power down */
+	struct list_head mmap_list;
 };
 
 int lwis_ioreg_device_deinit(void);
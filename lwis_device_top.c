@@ -18,9 +18,12 @@
 #include <linux/device.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/kfifo.h>
 #include <linux/kthread.h>
+#include <linux/llist.h>
 #include <linux/module.h>
 #include <linux/platform_device.h>
+#include <linux/rculist.h>
 #include <linux/slab.h>
 
 #ifdef CONFIG_OF
@@ -36,6 +39,9 @@ static int lwis_top_register_io(struct lwis_device *lwis_dev, struct lwis_io_ent
 static int lwis_top_close(struct lwis_device *lwis_dev);
 static struct lwis_device_subclass_operations top_vops = {
 	.register_io = lwis_top_register_io,
+	.register_io_multi_write = NULL,
+	.register_io_multi = NULL,
+	.mmap = NULL,
 	.register_io_barrier = NULL,
 	.device_enable = NULL,
 	.device_disable = NULL,
@@ -48,15 +54,18 @@ static int lwis_top_event_subscribe(struct lwis_device *lwis_dev, int64_t trigge
 				    int trigger_device_id, int subscriber_device_id);
 static int lwis_top_event_unsubscribe(struct lwis_device *lwis_dev, int64_t trigger_event_id,
 				      int subscriber_device_id);
-static void lwis_top_event_notify(struct lwis_device *lwis_dev, int64_t trigger_event_id,
-				  int64_t trigger_event_count, int64_t trigger_event_timestamp,
-				  bool in_irq);
+static void lwis_top_event_notify(struct lwis_device *lwis_dev, struct lwis_device *trigger_dev,
+				  int64_t trigger_event_id, int64_t trigger_event_count,
+				  int64_t trigger_event_timestamp, bool in_irq);
 static void lwis_top_event_subscribe_release(struct lwis_device *lwis_dev);
+static void lwis_top_event_subscribe_release_trigger(struct lwis_device *lwis_dev,
+						     struct lwis_device *trigger_dev);
 static struct lwis_event_subscribe_operations top_subscribe_ops = {
 	.subscribe_event = lwis_top_event_subscribe,
 	.unsubscribe_event = lwis_top_event_unsubscribe,
 	.notify_event_subscriber = lwis_top_event_notify,
 	.release = lwis_top_event_subscribe_release,
+	.release_trigger = lwis_top_event_subscribe_release_trigger,
 };
 
 struct lwis_event_subscribe_info {
@@ -66,16 +75,14 @@ struct lwis_event_subscribe_info {
 	struct lwis_device *subscriber_dev;
 	/* LWIS device who will trigger an event */
 	struct lwis_device *trigger_dev;
-	/* Node in the lwis_top_device->event_subscribers list */
+	/* Notify the subscriber from the trigger's context instead of the
+	 * subscribe worker */
+	bool direct_delivery;
+	/* Node in the lwis_event_subscriber_list->list, RCU protected */
 	struct list_head list_node;
 	/* List of event subscriber info */
 	struct lwis_event_subscriber_list *event_subscriber_list;
-};
-
-struct lwis_event_subscriber_list {
-	int64_t trigger_event_id;
-	struct list_head list;
-	struct hlist_node node;
+	struct rcu_head rcu;
 };
 
 struct lwis_trigger_event_info {
@@ -85,18 +92,35 @@ struct lwis_trigger_event_info {
 	int64_t trigger_event_count;
 	/* Store emitted event timestamp from trigger device */
 	int64_t trigger_event_timestamp;
-	/* node of list head */
-	struct list_head node;
 };
 
-static struct lwis_event_subscriber_list *event_subscriber_list_find(struct lwis_device *lwis_dev,
-								     int64_t trigger_event_id)
-{
-	struct lwis_top_device *lwis_top_dev =
-		container_of(lwis_dev, struct lwis_top_device, base_dev);
+struct lwis_event_subscriber_list {
+	int64_t trigger_event_id;
+	/* Subscribers, read under RCU and written under the trigger device's
+	 * subscribe_lock */
+	struct list_head list;
+	/* Node in the trigger lwis_device->event_subscribers hash table */
+	struct hlist_node node;
+	/* Number of subscribers notified by the subscribe worker */
+	int num_deferred;
+	/* Serializes the producers of pending, the subscribe worker is its
+	 * only consumer and reads it without locking */
+	spinlock_t pending_lock;
+	/* Emitted trigger events waiting for the subscribe worker */
+	DECLARE_KFIFO(pending, struct lwis_trigger_event_info, LWIS_TOP_PENDING_EVENTS_DEPTH);
+	/* Set while the list is in lwis_top_device->queued_lists */
+	atomic_t queued;
+	struct llist_node queued_node;
+	/* Node in a local list of lists to free */
+	struct list_head free_node;
+};
 
+/* Called under rcu_read_lock or with trigger_dev->subscribe_lock held */
+static struct lwis_event_subscriber_list *
+event_subscriber_list_find(struct lwis_device *trigger_dev, int64_t trigger_event_id)
+{
 	struct lwis_event_subscriber_list *list;
-	hash_for_each_possible (lwis_top_dev->event_subscribers, list, node, trigger_event_id) {
+	hash_for_each_possible_rcu (trigger_dev->event_subscribers, list, node, trigger_event_id) {
 		if (list->trigger_event_id == trigger_event_id) {
 			return list;
 		}
@@ -104,95 +128,130 @@ static struct lwis_event_subscriber_list *event_subscriber_list_find(struct lwis
 	return NULL;
 }
 
-static struct lwis_event_subscriber_list *event_subscriber_list_create(struct lwis_device *lwis_dev,
-								       int64_t trigger_event_id)
+/* Called with trigger_dev->subscribe_lock held */
+static struct lwis_event_subscriber_list *
+event_subscriber_list_create(struct lwis_device *trigger_dev, int64_t trigger_event_id)
 {
-	struct lwis_top_device *lwis_top_dev =
-		container_of(lwis_dev, struct lwis_top_device, base_dev);
 	struct lwis_event_subscriber_list *event_subscriber_list =
 		kmalloc(sizeof(struct lwis_event_subscriber_list), GFP_KERNEL);
 	if (!event_subscriber_list) {
-		dev_err(lwis_dev->dev, "Can't allocate event subscriber list\n");
+		dev_err(trigger_dev->dev, "Can't allocate event subscriber list\n");
 		return NULL;
 	}
 	event_subscriber_list->trigger_event_id = trigger_event_id;
 	INIT_LIST_HEAD(&event_subscriber_list->list);
-	hash_add(lwis_top_dev->event_subscribers, &event_subscriber_list->node, trigger_event_id);
+	event_subscriber_list->num_deferred = 0;
+	spin_lock_init(&event_subscriber_list->pending_lock);
+	INIT_KFIFO(event_subscriber_list->pending);
+	atomic_set(&event_subscriber_list->queued, 0);
+	hash_add_rcu(trigger_dev->event_subscribers, &event_subscriber_list->node,
+		     trigger_event_id);
 	return event_subscriber_list;
 }
 
 static struct lwis_event_subscriber_list *
-event_subscriber_list_find_or_create(struct lwis_device *lwis_dev, int64_t trigger_event_id)
+event_subscriber_list_find_or_create(struct lwis_device *trigger_dev, int64_t trigger_event_id)
 {
 	struct lwis_event_subscriber_list *list =
-		event_subscriber_list_find(lwis_dev, trigger_event_id);
-	return (list == NULL) ? event_subscriber_list_create(lwis_dev, trigger_event_id) : list;
+		event_subscriber_list_find(trigger_dev, trigger_event_id);
+	return (list == NULL) ? event_subscriber_list_create(trigger_dev, trigger_event_id) : list;
+}
+
+/*
+ * Waits until no producer or subscribe worker can still see lists that were
+ * removed from the hash table, so they and their subscribers can be freed.
+ */
+static void event_subscriber_lists_quiesce(struct lwis_top_device *lwis_top_dev)
+{
+	/* Producers queue the work before leaving their RCU read section */
+	synchronize_rcu();
+	if (lwis_top_dev->base_dev.subscribe_worker_thread) {
+		kthread_flush_work(&lwis_top_dev->subscribe_work);
+	}
 }
 
 static void subscribe_work_func(struct kthread_work *work)
 {
 	struct lwis_top_device *lwis_top_dev =
 		container_of(work, struct lwis_top_device, subscribe_work);
-	struct lwis_trigger_event_info *trigger_event;
+	struct lwis_trigger_event_info trigger_event;
 	struct lwis_event_subscribe_info *subscribe_info;
-	struct list_head *it_sub, *it_sub_tmp;
-	struct lwis_event_subscriber_list *event_subscriber_list;
-	struct list_head *it_event_subscriber, *it_event_subscriber_tmp;
-	unsigned long flags;
-
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	list_for_each_safe (it_sub, it_sub_tmp, &lwis_top_dev->emitted_event_list_work) {
-		trigger_event = list_entry(it_sub, struct lwis_trigger_event_info, node);
-		list_del(&trigger_event->node);
-		event_subscriber_list = event_subscriber_list_find(&lwis_top_dev->base_dev,
-								   trigger_event->trigger_event_id);
-		if (!event_subscriber_list || list_empty(&event_subscriber_list->list)) {
-			dev_err(lwis_top_dev->base_dev.dev,
-				"Failed to find event subscriber list for %llx\n",
-				trigger_event->trigger_event_id);
-			kfree(trigger_event);
-			continue;
-		}
-		list_for_each_safe (it_event_subscriber, it_event_subscriber_tmp,
-				    &event_subscriber_list->list) {
-			subscribe_info = list_entry(it_event_subscriber,
-						    struct lwis_event_subscribe_info, list_node);
-			/* Notify subscriber an event is happening */
-			lwis_device_external_event_emit(subscribe_info->subscriber_dev,
-							trigger_event->trigger_event_id,
-							trigger_event->trigger_event_count,
-							trigger_event->trigger_event_timestamp,
-							false);
+	struct lwis_event_subscriber_list *event_subscriber_list, *tmp;
+	struct llist_node *queued;
+
+	queued = llist_reverse_order(llist_del_all(&lwis_top_dev->queued_lists));
+	llist_for_each_entry_safe (event_subscriber_list, tmp, queued, queued_node) {
+		/* Events pushed from here on queue the list again */
+		atomic_set(&event_subscriber_list->queued, 0);
+		smp_mb__after_atomic();
+		while (kfifo_get(&event_subscriber_list->pending, &trigger_event)) {
+			rcu_read_lock();
+			list_for_each_entry_rcu (subscribe_info, &event_subscriber_list->list,
+						 list_node) {
+				if (subscribe_info->direct_delivery) {
+					continue;
+				}
+				/* Notify subscriber an event is happening */
+				lwis_device_external_event_emit(
+					subscribe_info->subscriber_dev,
+					trigger_event.trigger_event_id,
+					trigger_event.trigger_event_count,
+					trigger_event.trigger_event_timestamp, false);
+			}
+			rcu_read_unlock();
 		}
-		kfree(trigger_event);
 	}
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 }
 
-static void lwis_top_event_notify(struct lwis_device *lwis_dev, int64_t trigger_event_id,
-				  int64_t trigger_event_count, int64_t trigger_event_timestamp,
-				  bool in_irq)
+static void lwis_top_event_notify(struct lwis_device *lwis_dev, struct lwis_device *trigger_dev,
+				  int64_t trigger_event_id, int64_t trigger_event_count,
+				  int64_t trigger_event_timestamp, bool in_irq)
 {
 	struct lwis_top_device *lwis_top_dev =
 		container_of(lwis_dev, struct lwis_top_device, base_dev);
+	struct lwis_event_subscriber_list *event_subscriber_list;
+	struct lwis_event_subscribe_info *subscribe_info;
+	struct lwis_trigger_event_info trigger_event = {
+		.trigger_event_id = trigger_event_id,
+		.trigger_event_count = trigger_event_count,
+		.trigger_event_timestamp = trigger_event_timestamp,
+	};
 	unsigned long flags;
+	bool pushed;
 
-	struct lwis_trigger_event_info *trigger_event =
-		kmalloc(sizeof(struct lwis_trigger_event_info), GFP_ATOMIC);
-	if (trigger_event == NULL) {
-		dev_err(lwis_top_dev->base_dev.dev, "Allocate trigger_event_info failed");
+	rcu_read_lock();
+	event_subscriber_list = event_subscriber_list_find(trigger_dev, trigger_event_id);
+	if (!event_subscriber_list) {
+		rcu_read_unlock();
 		return;
 	}
 
-	INIT_LIST_HEAD(&trigger_event->node);
-	trigger_event->trigger_event_id = trigger_event_id;
-	trigger_event->trigger_event_count = trigger_event_count;
-	trigger_event->trigger_event_timestamp = trigger_event_timestamp;
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	list_add_tail(&trigger_event->node, &lwis_top_dev->emitted_event_list_work);
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
-	/* Schedule deferred subscribed events */
-	kthread_queue_work(&lwis_top_dev->base_dev.subscribe_worker, &lwis_top_dev->subscribe_work);
+	/* Direct subscribers only run non-blocking work, as if in IRQ context */
+	list_for_each_entry_rcu (subscribe_info, &event_subscriber_list->list, list_node) {
+		if (subscribe_info->direct_delivery) {
+			lwis_device_external_event_emit(subscribe_info->subscriber_dev,
+							trigger_event_id, trigger_event_count,
+							trigger_event_timestamp, /*in_irq=*/true);
+		}
+	}
+
+	if (READ_ONCE(event_subscriber_list->num_deferred) > 0) {
+		spin_lock_irqsave(&event_subscriber_list->pending_lock, flags);
+		pushed = kfifo_put(&event_subscriber_list->pending, trigger_event);
+		spin_unlock_irqrestore(&event_subscriber_list->pending_lock, flags);
+		if (!pushed) {
+			dev_err_ratelimited(lwis_top_dev->base_dev.dev,
+					    "Subscribe worker fell behind, dropped event %llx\n",
+					    trigger_event_id);
+		} else if (atomic_cmpxchg(&event_subscriber_list->queued, 0, 1) == 0) {
+			llist_add(&event_subscriber_list->queued_node,
+				  &lwis_top_dev->queued_lists);
+		}
+		/* Schedule deferred subscribed events */
+		kthread_queue_work(&lwis_top_dev->base_dev.subscribe_worker,
+				   &lwis_top_dev->subscribe_work);
+	}
+	rcu_read_unlock();
 }
 
 static int lwis_top_event_subscribe(struct lwis_device *lwis_dev, int64_t trigger_event_id,
@@ -205,8 +264,6 @@ static int lwis_top_event_subscribe(struct lwis_device *lwis_dev, int64_t trigge
 	struct lwis_event_subscribe_info *old_subscription;
 	struct lwis_event_subscribe_info *new_subscription;
 	struct lwis_event_subscriber_list *event_subscriber_list;
-	struct list_head *it_event_subscriber;
-	unsigned long flags;
 	int ret = 0;
 	bool has_subscriber = true;
 
@@ -215,19 +272,19 @@ static int lwis_top_event_subscribe(struct lwis_device *lwis_dev, int64_t trigge
 		return -EINVAL;
 	}
 
-	event_subscriber_list = event_subscriber_list_find_or_create(lwis_dev, trigger_event_id);
+	mutex_lock(&lwis_trigger_dev->subscribe_lock);
+	event_subscriber_list =
+		event_subscriber_list_find_or_create(lwis_trigger_dev, trigger_event_id);
 	if (!event_subscriber_list) {
+		mutex_unlock(&lwis_trigger_dev->subscribe_lock);
 		dev_err(lwis_dev->dev, "Can't find/create event subscriber list\n");
 		return -EINVAL;
 	}
 
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	list_for_each (it_event_subscriber, &event_subscriber_list->list) {
-		old_subscription = list_entry(it_event_subscriber, struct lwis_event_subscribe_info,
-					      list_node);
+	list_for_each_entry (old_subscription, &event_subscriber_list->list, list_node) {
 		/* Event already registered for this device */
 		if (old_subscription->subscriber_dev->id == subscriber_device_id) {
-			spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
+			mutex_unlock(&lwis_trigger_dev->subscribe_lock);
 			dev_info(
 				lwis_dev->dev,
 				"Already subscribed event: %llx, trigger device: %s, subscriber device: %s\n",
@@ -236,11 +293,11 @@ static int lwis_top_event_subscribe(struct lwis_device *lwis_dev, int64_t trigge
 			return 0;
 		}
 	}
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 
 	/* If the subscription does not exist in hash table, create one */
 	new_subscription = kmalloc(sizeof(struct lwis_event_subscribe_info), GFP_KERNEL);
 	if (!new_subscription) {
+		mutex_unlock(&lwis_trigger_dev->subscribe_lock);
 		dev_err(lwis_top_dev->base_dev.dev,
 			"Failed to allocate memory for new subscription\n");
 		return -ENOMEM;
@@ -249,10 +306,16 @@ static int lwis_top_event_subscribe(struct lwis_device *lwis_dev, int64_t trigge
 	new_subscription->event_id = trigger_event_id;
 	new_subscription->subscriber_dev = lwis_subscriber_dev;
 	new_subscription->trigger_dev = lwis_trigger_dev;
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	list_add_tail(&new_subscription->list_node, &event_subscriber_list->list);
+	/* Only IOREG transactions can run from the trigger's context */
+	new_subscription->direct_delivery = lwis_subscriber_dev->type == DEVICE_TYPE_IOREG &&
+					    lwis_subscriber_dev->direct_event_delivery;
 	new_subscription->event_subscriber_list = event_subscriber_list;
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
+	if (!new_subscription->direct_delivery) {
+		WRITE_ONCE(event_subscriber_list->num_deferred,
+			   event_subscriber_list->num_deferred + 1);
+	}
+	list_add_tail_rcu(&new_subscription->list_node, &event_subscriber_list->list);
+	mutex_unlock(&lwis_trigger_dev->subscribe_lock);
 	dev_info(lwis_dev->dev, "Subscribe event: %llx, trigger device: %s, subscriber device: %s",
 		 trigger_event_id, lwis_trigger_dev->name, lwis_subscriber_dev->name);
 
@@ -270,104 +333,110 @@ static int lwis_top_event_unsubscribe(struct lwis_device *lwis_dev, int64_t trig
 {
 	struct lwis_top_device *lwis_top_dev =
 		container_of(lwis_dev, struct lwis_top_device, base_dev);
-	struct lwis_device *trigger_dev = NULL;
+	struct lwis_device *trigger_dev =
+		lwis_find_dev_by_id(EVENT_OWNER_DEVICE_ID(trigger_event_id));
 	struct lwis_event_subscribe_info *subscribe_info = NULL;
+	struct lwis_event_subscribe_info *tmp;
 	struct lwis_event_subscriber_list *event_subscriber_list;
-	struct list_head *it_event_subscriber, *it_event_subscriber_tmp;
-	struct lwis_trigger_event_info *pending_event, *n;
-	unsigned long flags;
 	bool has_subscriber = false;
 
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	event_subscriber_list = event_subscriber_list_find(lwis_dev, trigger_event_id);
+	if (trigger_dev == NULL) {
+		dev_err(lwis_top_dev->base_dev.dev, "LWIS trigger device not found for %llx\n",
+			trigger_event_id);
+		return -EINVAL;
+	}
+
+	mutex_lock(&trigger_dev->subscribe_lock);
+	event_subscriber_list = event_subscriber_list_find(trigger_dev, trigger_event_id);
 	if (!event_subscriber_list || list_empty(&event_subscriber_list->list)) {
-		spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
+		mutex_unlock(&trigger_dev->subscribe_lock);
 		dev_err(lwis_top_dev->base_dev.dev,
 			"Failed to find event subscriber list for %llx\n", trigger_event_id);
 		return -EINVAL;
 	}
 
-	list_for_each_safe (it_event_subscriber, it_event_subscriber_tmp,
-			    &event_subscriber_list->list) {
-		subscribe_info = list_entry(it_event_subscriber, struct lwis_event_subscribe_info,
-					    list_node);
-		if (subscribe_info->subscriber_dev->id == subscriber_device_id) {
-			dev_info(
-				lwis_dev->dev,
-				"Unsubscribe event: %llx, trigger device: %s, subscriber device: %s\n",
-				trigger_event_id, subscribe_info->trigger_dev->name,
-				subscribe_info->subscriber_dev->name);
-			trigger_dev = subscribe_info->trigger_dev;
-			list_del(&subscribe_info->list_node);
-			if (list_empty(&subscribe_info->event_subscriber_list->list)) {
-				/* Clear pending events */
-				list_for_each_entry_safe (pending_event, n,
-							  &lwis_top_dev->emitted_event_list_work,
-							  node) {
-					if (pending_event->trigger_event_id == trigger_event_id) {
-						list_del(&pending_event->node);
-						kfree(pending_event);
-					}
-				}
-				hash_del(&subscribe_info->event_subscriber_list->node);
-				kfree(subscribe_info->event_subscriber_list);
-				kfree(subscribe_info);
-				spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
-				lwis_device_event_update_subscriber(trigger_dev, trigger_event_id,
-								    has_subscriber);
-				return 0;
-			}
+	list_for_each_entry_safe (subscribe_info, tmp, &event_subscriber_list->list, list_node) {
+		if (subscribe_info->subscriber_dev->id != subscriber_device_id) {
+			continue;
+		}
+		dev_info(lwis_dev->dev,
+			 "Unsubscribe event: %llx, trigger device: %s, subscriber device: %s\n",
+			 trigger_event_id, subscribe_info->trigger_dev->name,
+			 subscribe_info->subscriber_dev->name);
+		list_del_rcu(&subscribe_info->list_node);
+		if (!subscribe_info->direct_delivery) {
+			WRITE_ONCE(event_subscriber_list->num_deferred,
+				   event_subscriber_list->num_deferred - 1);
+		}
+		if (list_empty(&event_subscriber_list->list)) {
+			/* Drops the pending events along with the list */
+			hash_del_rcu(&event_subscriber_list->node);
+			mutex_unlock(&trigger_dev->subscribe_lock);
+			/* Unhashed already, so waiting for readers needs no lock */
+			event_subscriber_lists_quiesce(lwis_top_dev);
 			kfree(subscribe_info);
+			kfree(event_subscriber_list);
+			lwis_device_event_update_subscriber(trigger_dev, trigger_event_id,
+							    has_subscriber);
+			return 0;
 		}
+		kfree_rcu(subscribe_info, rcu);
 	}
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
+	mutex_unlock(&trigger_dev->subscribe_lock);
 	return 0;
 }
 
 static void lwis_top_event_subscribe_init(struct lwis_top_device *lwis_top_dev)
 {
-	hash_init(lwis_top_dev->event_subscribers);
-	INIT_LIST_HEAD(&lwis_top_dev->emitted_event_list_work);
+	init_llist_head(&lwis_top_dev->queued_lists);
 	kthread_init_work(&lwis_top_dev->subscribe_work, subscribe_work_func);
 }
 
-static void lwis_top_event_subscribe_clear(struct lwis_top_device *lwis_top_dev)
+/* Moves the subscriber lists of a trigger device out of its table, onto data */
+static void event_subscriber_lists_detach(struct lwis_device *trigger_dev, void *data)
 {
+	struct list_head *free_lists = data;
 	struct lwis_event_subscriber_list *event_subscriber_list;
-	struct list_head *it_event_subscriber, *it_event_subscriber_tmp;
-	struct lwis_event_subscribe_info *subscribe_info;
-	struct hlist_node *tmp;
-	struct lwis_trigger_event_info *pending_event, *n;
+	struct hlist_node *it_tmp;
 	int i;
-	unsigned long flags;
 
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	/* Clean up subscription table */
-	hash_for_each_safe (lwis_top_dev->event_subscribers, i, tmp, event_subscriber_list, node) {
-		list_for_each_safe (it_event_subscriber, it_event_subscriber_tmp,
-				    &event_subscriber_list->list) {
-			subscribe_info = list_entry(it_event_subscriber,
-						    struct lwis_event_subscribe_info, list_node);
-			/* Delete the node from the hash table */
+	mutex_lock(&trigger_dev->subscribe_lock);
+	hash_for_each_safe (trigger_dev->event_subscribers, i, it_tmp, event_subscriber_list,
+			    node) {
+		hash_del_rcu(&event_subscriber_list->node);
+		list_add_tail(&event_subscriber_list->free_node, free_lists);
+	}
+	mutex_unlock(&trigger_dev->subscribe_lock);
+}
+
+/* Frees detached subscriber lists, which must have been quiesced already */
+static void event_subscriber_lists_free(struct list_head *free_lists)
+{
+	struct lwis_event_subscriber_list *event_subscriber_list, *n;
+	struct lwis_event_subscribe_info *subscribe_info, *tmp;
+
+	list_for_each_entry_safe (event_subscriber_list, n, free_lists, free_node) {
+		list_for_each_entry_safe (subscribe_info, tmp, &event_subscriber_list->list,
+					  list_node) {
 			list_del(&subscribe_info->list_node);
-			if (list_empty(&subscribe_info->event_subscriber_list->list)) {
-				hash_del(&subscribe_info->event_subscriber_list->node);
-				kfree(subscribe_info->event_subscriber_list);
-			}
 			kfree(subscribe_info);
 		}
+		kfree(event_subscriber_list);
 	}
+}
 
-	/* Clean up emitted event list */
-	list_for_each_entry_safe (pending_event, n, &lwis_top_dev->emitted_event_list_work, node) {
-		list_del(&pending_event->node);
-		kfree(pending_event);
-	}
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
+static void lwis_top_event_subscribe_clear(struct lwis_top_device *lwis_top_dev)
+{
+	struct list_head free_lists;
 
-	if (lwis_top_dev->base_dev.subscribe_worker_thread) {
-		kthread_flush_worker(&lwis_top_dev->base_dev.subscribe_worker);
-	}
+	INIT_LIST_HEAD(&free_lists);
+
+	/* Clean up the subscription tables of every trigger device */
+	lwis_for_each_dev(event_subscriber_lists_detach, &free_lists);
+	/* Lists out of the tables are no longer visible once quiesced, so the
+	 * emitted events still pending in them are dropped with them */
+	event_subscriber_lists_quiesce(lwis_top_dev);
+	event_subscriber_lists_free(&free_lists);
 }
 
 static void lwis_top_event_subscribe_release(struct lwis_device *lwis_dev)
@@ -378,6 +447,21 @@ static void lwis_top_event_subscribe_release(struct lwis_device *lwis_dev)
 	lwis_top_event_subscribe_clear(lwis_top_dev);
 }
 
+static void lwis_top_event_subscribe_release_trigger(struct lwis_device *lwis_dev,
+						     struct lwis_device *trigger_dev)
+{
+	struct lwis_top_device *lwis_top_dev =
+		container_of(lwis_dev, struct lwis_top_device, base_dev);
+	struct list_head free_lists;
+
+	INIT_LIST_HEAD(&free_lists);
+
+	/* Only the table of trigger_dev goes away, the other devices keep theirs */
+	event_subscriber_lists_detach(trigger_dev, &free_lists);
+	event_subscriber_lists_quiesce(lwis_top_dev);
+	event_subscriber_lists_free(&free_lists);
+}
+
 static int lwis_top_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				int access_size)
 {
@@ -530,6 +614,12 @@ static int lwis_top_device_probe(struct platform_device *plat_dev)
 		goto error_probe;
 	}
 
+	if (top_dev->base_dev.subscribe_thread_cpu_mask != 0) {
+		lwis_set_kthread_affinity(&top_dev->base_dev,
+					  top_dev->base_dev.subscribe_worker_thread,
+					  top_dev->base_dev.subscribe_thread_cpu_mask);
+	}
+
 	return 0;
 
 error_probe:
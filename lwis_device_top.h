@@ -11,9 +11,14 @@
 #ifndef LWIS_DEVICE_TOP_H_
 #define LWIS_DEVICE_TOP_H_
 
+#include <linux/llist.h>
+
 #include "lwis_device.h"
 
 #define SCRATCH_MEMORY_SIZE 16
+/* Emitted events each trigger event can hold for the subscribe worker,
+ * power of 2 */
+#define LWIS_TOP_PENDING_EVENTS_DEPTH 32
 
 /*
  *  struct lwis_top_device
@@ -25,12 +30,10 @@ struct lwis_top_device {
 	 * top device.
 	 */
 	uint8_t scratch_mem[SCRATCH_MEMORY_SIZE];
-	/* Hash table of event subscribers keyed by trigger event id */
-	DECLARE_HASHTABLE(event_subscribers, EVENT_HASH_BITS);
-
 	/* Subscription work */
 	struct kthread_work subscribe_work;
-	struct list_head emitted_event_list_work;
+	/* Subscriber lists with emitted events for the subscribe worker */
+	struct llist_head queued_lists;
 };
 
 int lwis_top_device_deinit(void);
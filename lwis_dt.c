@@ -13,6 +13,7 @@
 #include "lwis_dt.h"
 
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/of.h>
 #include <linux/of_address.h>
 #include <linux/of_gpio.h>
@@ -452,6 +453,12 @@ static int parse_interrupts(struct lwis_device *lwis_dev)
 		int irq_reg_bid_count;
 		/* To match default value of reg-addr/value-bitwidth. */
 		u32 irq_reg_bitwidth = 32;
+		/* Storm detection is off unless a threshold is given */
+		u32 storm_threshold = 0;
+		u32 storm_window_ms = 0;
+		u32 storm_cooldown_ms = 0;
+		/* Keep the platform default affinity unless CPUs are given */
+		u64 irq_cpu_mask = 0;
 		int j;
 		struct device_node *event_info = of_node_get(it.node);
 
@@ -584,6 +591,18 @@ static int parse_interrupts(struct lwis_device *lwis_dev)
 			goto error_event_infos;
 		}
 
+		of_property_read_u32(event_info, "irq-storm-threshold", &storm_threshold);
+		of_property_read_u32(event_info, "irq-storm-window-ms", &storm_window_ms);
+		of_property_read_u32(event_info, "irq-storm-cooldown-ms", &storm_cooldown_ms);
+		lwis_interrupt_set_storm_limits(lwis_dev->irqs, i, storm_threshold, storm_window_ms,
+						storm_cooldown_ms);
+
+		of_property_read_u64(event_info, "irq-cpu-mask", &irq_cpu_mask);
+		if (irq_cpu_mask != 0 &&
+		    lwis_interrupt_set_affinity(lwis_dev->irqs, i, irq_cpu_mask) != 0) {
+			pr_warn("Cannot set CPU mask 0x%llx for interrupt %d\n", irq_cpu_mask, i);
+		}
+
 		of_node_put(event_info);
 		i++;
 		if (critical_events) {
@@ -943,6 +962,18 @@ static int parse_access_mode(struct lwis_device *lwis_dev)
 	return 0;
 }
 
+static int parse_event_delivery(struct lwis_device *lwis_dev)
+{
+	struct device_node *dev_node;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+
+	lwis_dev->direct_event_delivery =
+		of_property_read_bool(dev_node, "lwis,direct-event-delivery");
+
+	return 0;
+}
+
 static int parse_thread_priority(struct lwis_device *lwis_dev)
 {
 	struct device_node *dev_node;
@@ -950,15 +981,153 @@ static int parse_thread_priority(struct lwis_device *lwis_dev)
 	dev_node = lwis_dev->plat_dev->dev.of_node;
 	lwis_dev->transaction_thread_priority = 0;
 	lwis_dev->periodic_io_thread_priority = 0;
+	lwis_dev->transaction_thread_cpu_mask = 0;
+	lwis_dev->periodic_io_thread_cpu_mask = 0;
+	lwis_dev->subscribe_thread_cpu_mask = 0;
 
 	of_property_read_u32(dev_node, "transaction-thread-priority",
 			     &lwis_dev->transaction_thread_priority);
 	of_property_read_u32(dev_node, "periodic-io-thread-priority",
 			     &lwis_dev->periodic_io_thread_priority);
+	of_property_read_u64(dev_node, "transaction-thread-cpu-mask",
+			     &lwis_dev->transaction_thread_cpu_mask);
+	of_property_read_u64(dev_node, "periodic-io-thread-cpu-mask",
+			     &lwis_dev->periodic_io_thread_cpu_mask);
+	of_property_read_u64(dev_node, "subscribe-thread-cpu-mask",
+			     &lwis_dev->subscribe_thread_cpu_mask);
 
 	return 0;
 }
 
+static int parse_allocator_reserve_blocks(struct lwis_device *lwis_dev)
+{
+	struct device_node *dev_node;
+	int count;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+	memset(lwis_dev->allocator_reserve_blocks, 0, sizeof(lwis_dev->allocator_reserve_blocks));
+
+	/* Optional, one block count per allocator pool from 8K to 512K */
+	count = of_property_count_elems_of_size(dev_node, "allocator-reserve-blocks", sizeof(u32));
+	if (count <= 0) {
+		return 0;
+	}
+	if (count > LWIS_ALLOCATOR_NUM_POOLS) {
+		pr_err("allocator-reserve-blocks has %d entries, expected at most %d\n", count,
+		       LWIS_ALLOCATOR_NUM_POOLS);
+		return -EINVAL;
+	}
+
+	return of_property_read_u32_array(dev_node, "allocator-reserve-blocks",
+					  lwis_dev->allocator_reserve_blocks, count);
+}
+
+static int parse_i2c_reg_ranges(struct device_node *dev_node, const char *name, u32 **pairs)
+{
+	int count;
+	int ret;
+
+	count = of_property_count_u32_elems(dev_node, name);
+	if (count <= 0) {
+		return 0;
+	}
+	if (count % 2) {
+		pr_err("%s should be a list of <start end> pairs\n", name);
+		return -EINVAL;
+	}
+
+	*pairs = kmalloc(sizeof(u32) * count, GFP_KERNEL);
+	if (!*pairs) {
+		return -ENOMEM;
+	}
+
+	ret = of_property_read_u32_array(dev_node, name, *pairs, count);
+	if (ret) {
+		pr_err("Error reading %s (%d)\n", name, ret);
+		kfree(*pairs);
+		*pairs = NULL;
+		return ret;
+	}
+
+	return count / 2;
+}
+
+static int parse_i2c_reg_cache(struct lwis_i2c_device *i2c_dev)
+{
+	struct device_node *dev_node;
+	u32 *pairs = NULL;
+	int num_ranges;
+	u64 num_regs = 0;
+	int i;
+
+	dev_node = i2c_dev->base_dev.plat_dev->dev.of_node;
+
+	i2c_dev->reg_cache_skip_redundant_writes =
+		of_property_read_bool(dev_node, "i2c-cache-skip-redundant-writes");
+
+	num_ranges = parse_i2c_reg_ranges(dev_node, "i2c-cache-ranges", &pairs);
+	if (num_ranges <= 0) {
+		return num_ranges;
+	}
+
+	i2c_dev->reg_cache = kcalloc(num_ranges, sizeof(*i2c_dev->reg_cache), GFP_KERNEL);
+	if (!i2c_dev->reg_cache) {
+		kfree(pairs);
+		return -ENOMEM;
+	}
+	for (i = 0; i < num_ranges; ++i) {
+		if (pairs[2 * i] > pairs[2 * i + 1]) {
+			pr_err("i2c-cache-ranges entry %d is reversed\n", i);
+			goto error_range;
+		}
+		/* Accumulate in 64 bits, a single range can span all of u32 */
+		num_regs += (u64)pairs[2 * i + 1] - pairs[2 * i] + 1;
+		if (num_regs > LWIS_I2C_REG_CACHE_MAX_REGS) {
+			pr_err("i2c-cache-ranges cover more than %d registers\n",
+			       LWIS_I2C_REG_CACHE_MAX_REGS);
+			goto error_range;
+		}
+		i2c_dev->reg_cache[i].range.start = pairs[2 * i];
+		i2c_dev->reg_cache[i].range.end = pairs[2 * i + 1];
+	}
+	i2c_dev->num_reg_cache_blocks = num_ranges;
+	kfree(pairs);
+	pairs = NULL;
+
+	/* Volatile registers are only meaningful inside the cacheable ranges */
+	num_ranges = parse_i2c_reg_ranges(dev_node, "i2c-volatile-ranges", &pairs);
+	if (num_ranges <= 0) {
+		return num_ranges;
+	}
+
+	i2c_dev->volatile_regs = kcalloc(num_ranges, sizeof(*i2c_dev->volatile_regs), GFP_KERNEL);
+	if (!i2c_dev->volatile_regs) {
+		kfree(pairs);
+		return -ENOMEM;
+	}
+	for (i = 0; i < num_ranges; ++i) {
+		if (pairs[2 * i] > pairs[2 * i + 1]) {
+			pr_err("i2c-volatile-ranges entry %d is reversed\n", i);
+			kfree(i2c_dev->volatile_regs);
+			i2c_dev->volatile_regs = NULL;
+			kfree(pairs);
+			return -EINVAL;
+		}
+		i2c_dev->volatile_regs[i].start = pairs[2 * i];
+		i2c_dev->volatile_regs[i].end = pairs[2 * i + 1];
+	}
+	i2c_dev->num_volatile_regs = num_ranges;
+	kfree(pairs);
+
+	return 0;
+
+error_range:
+	kfree(i2c_dev->reg_cache);
+	i2c_dev->reg_cache = NULL;
+	kfree(pairs);
+	return -EINVAL;
+}
+
 static int parse_i2c_lock_group_id(struct lwis_i2c_device *i2c_dev)
 {
 	struct device_node *dev_node;
@@ -985,6 +1154,22 @@ static int parse_i2c_lock_group_id(struct lwis_i2c_device *i2c_dev)
 	return 0;
 }
 
+static int parse_i2c_transfer_priority(struct lwis_i2c_device *i2c_dev)
+{
+	struct device_node *dev_node;
+
+	dev_node = i2c_dev->base_dev.plat_dev->dev.of_node;
+	i2c_dev->transfer_priority = LWIS_I2C_SCHED_PRIORITY_NORMAL;
+	of_property_read_u32(dev_node, "i2c-transfer-priority", &i2c_dev->transfer_priority);
+	if (i2c_dev->transfer_priority >= LWIS_I2C_SCHED_NUM_PRIORITIES) {
+		pr_err("i2c-transfer-priority need smaller than %d\n",
+		       LWIS_I2C_SCHED_NUM_PRIORITIES);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 int lwis_base_parse_dt(struct lwis_device *lwis_dev)
 {
 	struct device *dev;
@@ -1089,7 +1274,14 @@ int lwis_base_parse_dt(struct lwis_device *lwis_dev)
 		return ret;
 	}
 
+	ret = parse_allocator_reserve_blocks(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing allocator-reserve-blocks\n");
+		return ret;
+	}
+
 	parse_access_mode(lwis_dev);
+	parse_event_delivery(lwis_dev);
 	parse_thread_priority(lwis_dev);
 	parse_bitwidths(lwis_dev);
 
@@ -1135,6 +1327,25 @@ int lwis_i2c_device_parse_dt(struct lwis_i2c_device *i2c_dev)
 		return ret;
 	}
 
+	ret = parse_i2c_transfer_priority(i2c_dev);
+	if (ret) {
+		dev_err(i2c_dev->base_dev.dev, "Error parsing i2c transfer priority\n");
+		return ret;
+	}
+
+	i2c_dev->max_batch_size = LWIS_I2C_DEFAULT_MAX_BATCH_SIZE;
+	of_property_read_u32(dev_node, "i2c-max-batch-size", &i2c_dev->max_batch_size);
+	i2c_dev->batch_writes = of_property_read_bool(dev_node, "i2c-batch-writes");
+	i2c_dev->fifo_streaming = of_property_read_bool(dev_node, "i2c-fifo-streaming");
+	i2c_dev->page_size = 0;
+	of_property_read_u32(dev_node, "i2c-page-size", &i2c_dev->page_size);
+
+	ret = parse_i2c_reg_cache(i2c_dev);
+	if (ret) {
+		dev_err(i2c_dev->base_dev.dev, "Error parsing i2c register cache ranges\n");
+		return ret;
+	}
+
 	return 0;
 }
 
@@ -1169,6 +1380,16 @@ int lwis_ioreg_device_parse_dt(struct lwis_ioreg_device *ioreg_dev)
 			dev_err(ioreg_dev->base_dev.dev, "Cannot set ioreg info for %s\n", name);
 			goto error_ioreg;
 		}
+		/* Only blocks listed in reg-mmap-names may be mapped by userspace */
+		ioreg_dev->reg_list.block[i].mmap_allowed =
+			name && of_property_match_string(dev_node, "reg-mmap-names", name) >= 0;
+		if (ioreg_dev->reg_list.block[i].mmap_allowed &&
+		    (!PAGE_ALIGNED(ioreg_dev->reg_list.block[i].start) ||
+		     !PAGE_ALIGNED(ioreg_dev->reg_list.block[i].size))) {
+			dev_warn(ioreg_dev->base_dev.dev,
+				 "Block %s is in reg-mmap-names but is not page aligned, it can't be mapped\n",
+				 name);
+		}
 	}
 
 	return 0;
@@ -15,15 +15,13 @@
 
 #include "lwis_device.h"
 #include "lwis_event.h"
+#include "lwis_periodic_io.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
 
 /* Maximum number of pending events in the event queues */
 #define MAX_NUM_PENDING_EVENTS 2048
 
-/* Exposes the device id embedded in the event id */
-#define EVENT_OWNER_DEVICE_ID(x) ((x >> LWIS_EVENT_ID_EVENT_CODE_LEN) & 0xFFFF)
-
 #define lwis_dev_err_ratelimited(dev, fmt, ...)					\
 	{									\
 		static int64_t timestamp = 0;					\
@@ -682,6 +680,7 @@ int lwis_device_event_flags_updated(struct lwis_device *lwis_dev, int64_t event_
 	struct lwis_device_event_state *state;
 	int ret = 0;
 	bool call_enable_cb = false, event_enabled = false;
+	bool call_once_cb = false;
 	/* Flags for irqsave */
 	unsigned long flags;
 	/* Find our state */
@@ -710,8 +709,22 @@ int lwis_device_event_flags_updated(struct lwis_device *lwis_dev, int64_t event_
 		event_enabled = false;
 		call_enable_cb = (state->enable_counter == 0);
 	}
+	/* Track whether any client wants the IRQ masked after it fires once */
+	if (!(old_flags & LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE) &&
+	    (new_flags & LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE)) {
+		state->enable_once_counter++;
+		call_once_cb = (state->enable_once_counter == 1);
+	} else if ((old_flags & LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE) &&
+		   !(new_flags & LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE)) {
+		state->enable_once_counter--;
+		call_once_cb = (state->enable_once_counter == 0);
+	}
 	/* Restore the lock */
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+	if (call_once_cb && lwis_dev->irqs) {
+		lwis_interrupt_event_set_enable_once(lwis_dev->irqs, event_id,
+						     state->enable_once_counter > 0);
+	}
 	/* Handle event being enabled or disabled */
 	if (call_enable_cb) {
 		/* Call our handler dispatcher */
@@ -799,7 +812,7 @@ int lwis_device_event_enable(struct lwis_device *lwis_dev, int64_t event_id, boo
 }
 
 static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t event_id,
-				       void *payload, size_t payload_size,
+				       void *payload, size_t payload_size, int64_t timestamp,
 				       struct list_head *pending_events, bool in_irq)
 {
 	struct lwis_client_event_state *client_event_state;
@@ -808,7 +821,6 @@ static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t eve
 	/* Our iterators */
 	struct lwis_client *lwis_client;
 	struct list_head *p, *n;
-	int64_t timestamp;
 	int64_t event_counter;
 	/* Flags for IRQ disable */
 	unsigned long flags;
@@ -829,8 +841,10 @@ static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t eve
 	device_event_state->event_counter++;
 	/* Save event counter to local variable */
 	event_counter = device_event_state->event_counter;
-	/* Latch timestamp */
-	timestamp = ktime_to_ns(lwis_get_time());
+	/* Latch timestamp, unless the caller already did when the event occurred */
+	if (timestamp <= 0) {
+		timestamp = ktime_to_ns(lwis_get_time());
+	}
 	/* Saves this event to history buffer */
 	save_device_event_state_to_history_locked(lwis_dev, device_event_state, timestamp);
 
@@ -842,7 +856,7 @@ static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t eve
 	/* Emit event to subscriber via top device */
 	if (has_subscriber) {
 		lwis_dev->top_dev->subscribe_ops.notify_event_subscriber(
-			lwis_dev->top_dev, event_id, event_counter, timestamp, in_irq);
+			lwis_dev->top_dev, lwis_dev, event_id, event_counter, timestamp, in_irq);
 	}
 
 	/* Run internal handler if any */
@@ -908,6 +922,9 @@ static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t eve
 				 "Failed to process transactions: Event ID: 0x%llx Counter: %lld\n",
 				 event_id, event_counter);
 		}
+
+		/* Re-phase periodic io anchored to this event */
+		lwis_periodic_io_event_trigger(lwis_client, event_id, timestamp);
 	}
 
 	return 0;
@@ -915,6 +932,14 @@ static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t eve
 
 int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void *payload,
 			   size_t payload_size, bool in_irq)
+{
+	return lwis_device_event_emit_timestamped(lwis_dev, event_id, payload, payload_size,
+						  /*timestamp=*/0, in_irq);
+}
+
+int lwis_device_event_emit_timestamped(struct lwis_device *lwis_dev, int64_t event_id,
+				       void *payload, size_t payload_size, int64_t timestamp,
+				       bool in_irq)
 {
 	int ret;
 	struct list_head pending_events;
@@ -924,7 +949,7 @@ int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void
 	INIT_LIST_HEAD(&pending_events);
 
 	/* Emit the original event */
-	ret = lwis_device_event_emit_impl(lwis_dev, event_id, payload, payload_size,
+	ret = lwis_device_event_emit_impl(lwis_dev, event_id, payload, payload_size, timestamp,
 					  &pending_events, in_irq);
 	if (ret) {
 		lwis_dev_err_ratelimited(lwis_dev->dev,
@@ -973,7 +998,7 @@ int lwis_pending_events_emit(struct lwis_device *lwis_dev, struct list_head *pen
 		emit_result = lwis_device_event_emit_impl(lwis_dev, event->event_info.event_id,
 							  event->event_info.payload_buffer,
 							  event->event_info.payload_size,
-							  pending_events, in_irq);
+							  /*timestamp=*/0, pending_events, in_irq);
 		if (emit_result) {
 			return_val = emit_result;
 			dev_warn_ratelimited(lwis_dev->dev,
@@ -1085,6 +1110,9 @@ void lwis_device_external_event_emit(struct lwis_device *lwis_dev, int64_t event
 				lwis_dev->dev,
 				"Failed to process transactions: external event ID: 0x%llx counter: %lld\n",
 				event_id, event_counter);
+
+		/* Re-phase periodic io anchored to this event */
+		lwis_periodic_io_event_trigger(lwis_client, event_id, timestamp);
 	}
 
 	lwis_pending_events_emit(lwis_dev, &pending_events, in_irq);
@@ -19,6 +19,9 @@
  *  LWIS Event Defines
  */
 
+/* Exposes the device id embedded in the event id */
+#define EVENT_OWNER_DEVICE_ID(x) ((x >> LWIS_EVENT_ID_EVENT_CODE_LEN) & 0xFFFF)
+
 /*
  *  LWIS Forward Declarations
  */
@@ -35,6 +38,8 @@ struct lwis_device;
 struct lwis_device_event_state {
 	int64_t event_id;
 	int64_t enable_counter;
+	/* Number of clients with LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE set */
+	int64_t enable_once_counter;
 	int64_t event_counter;
 	bool has_subscriber;
 	struct hlist_node node;
@@ -234,6 +239,15 @@ int lwis_device_event_enable(struct lwis_device *lwis_dev, int64_t event_id, boo
 int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void *payload,
 			   size_t payload_size, bool in_irq);
 
+/*
+ * lwis_device_event_emit_timestamped: Same as lwis_device_event_emit, but
+ * stamps the event with the given timestamp (in ns) instead of the time of
+ * the call, for events latched earlier. A timestamp <= 0 means now.
+ */
+int lwis_device_event_emit_timestamped(struct lwis_device *lwis_dev, int64_t event_id,
+				       void *payload, size_t payload_size, int64_t timestamp,
+				       bool in_irq);
+
 /*
  * lwis_device_external_event_emit: Emits an subscribed event to device.
  * The difference to lwis_device_event_emit is
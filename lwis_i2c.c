@@ -12,8 +12,10 @@
 
 #include "lwis_i2c.h"
 
+#include <linux/bitmap.h>
 #include <linux/bits.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
@@ -92,6 +94,21 @@ static int perform_write_transfer(struct i2c_client *client, struct i2c_msg *msg
 	return (ret == num_msg) ? 0 : ret;
 }
 
+/* Called with the adapter lock held */
+static int perform_read_batch_transfer(struct i2c_client *client, struct i2c_msg *msg,
+				       uint64_t offset, int offset_size_bytes)
+{
+	int ret = 0;
+	u8 *wbuf = msg[0].buf;
+
+	const int num_msg = 2;
+
+	value_to_buf(offset, wbuf, offset_size_bytes);
+	ret = __i2c_transfer(client->adapter, msg, num_msg);
+	return (ret == num_msg) ? 0 : ret;
+}
+
+/* Called with the adapter lock held */
 static int perform_write_batch_transfer(struct i2c_client *client, struct i2c_msg *msg,
 					uint64_t offset, int offset_size_bytes,
 					int value_size_bytes, uint8_t *value_buf)
@@ -104,10 +121,127 @@ static int perform_write_batch_transfer(struct i2c_client *client, struct i2c_ms
 	value_to_buf(offset, buf, offset_size_bytes);
 	memcpy(buf + offset_size_bytes, value_buf, value_size_bytes);
 
-	ret = i2c_transfer(client->adapter, msg, num_msg);
+	ret = __i2c_transfer(client->adapter, msg, num_msg);
 	return (ret == num_msg) ? 0 : ret;
 }
 
+/* Called with the adapter lock held */
+static int perform_write_gather_transfer(struct i2c_client *client, struct i2c_msg *msg,
+					 uint64_t offset, int offset_size_bytes)
+{
+	int ret = 0;
+	u8 *buf = msg[0].buf;
+
+	/* Offset header and payload, sent back to back without a new START */
+	const int num_msg = 2;
+
+	value_to_buf(offset, buf, offset_size_bytes);
+
+	ret = __i2c_transfer(client->adapter, msg, num_msg);
+	return (ret == num_msg) ? 0 : ret;
+}
+
+/*
+ * Returns the size of the largest chunk of a batch starting at offset that
+ * fits in one message of max_len bytes, 0 for no limit, and does not cross a
+ * page of the device. Fixed-offset batches are not paged.
+ */
+static int i2c_batch_chunk_size(struct lwis_i2c_device *i2c, uint64_t offset, int remaining,
+				int max_len, bool is_offset_fixed)
+{
+	int chunk = remaining;
+
+	if (max_len > 0) {
+		chunk = min(chunk, max_len);
+	}
+	if (i2c->page_size > 0 && !is_offset_fixed) {
+		chunk = min_t(int, chunk, i2c->page_size - ((u32)offset % i2c->page_size));
+	}
+	return chunk;
+}
+
+/*
+ * Returns the cache block holding the register at offset, or NULL if the
+ * register is not cacheable. Callers hold i2c->io_lock.
+ */
+static struct lwis_i2c_reg_cache_block *reg_cache_find(struct lwis_i2c_device *i2c,
+						       uint64_t offset)
+{
+	int i;
+
+	for (i = 0; i < i2c->num_volatile_regs; ++i) {
+		if (offset >= i2c->volatile_regs[i].start && offset <= i2c->volatile_regs[i].end) {
+			return NULL;
+		}
+	}
+	for (i = 0; i < i2c->num_reg_cache_blocks; ++i) {
+		if (offset >= i2c->reg_cache[i].range.start &&
+		    offset <= i2c->reg_cache[i].range.end) {
+			return &i2c->reg_cache[i];
+		}
+	}
+	return NULL;
+}
+
+static bool reg_cache_get(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *value)
+{
+	struct lwis_i2c_reg_cache_block *block = reg_cache_find(i2c, offset);
+	u32 idx;
+
+	if (!block) {
+		return false;
+	}
+	idx = offset - block->range.start;
+	if (!test_bit(idx, block->valid)) {
+		return false;
+	}
+	*value = block->values[idx];
+	return true;
+}
+
+static void reg_cache_set(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t value)
+{
+	struct lwis_i2c_reg_cache_block *block = reg_cache_find(i2c, offset);
+	u32 idx;
+
+	if (!block) {
+		return;
+	}
+	idx = offset - block->range.start;
+	block->values[idx] = value;
+	set_bit(idx, block->valid);
+}
+
+static void reg_cache_invalidate_range(struct lwis_i2c_device *i2c, uint64_t offset, size_t size)
+{
+	struct lwis_i2c_reg_cache_block *block;
+	uint64_t start;
+	uint64_t end;
+	int i;
+
+	if (size == 0) {
+		return;
+	}
+	for (i = 0; i < i2c->num_reg_cache_blocks; ++i) {
+		block = &i2c->reg_cache[i];
+		start = max_t(uint64_t, offset, block->range.start);
+		end = min_t(uint64_t, offset + size - 1, block->range.end);
+		if (start <= end) {
+			bitmap_clear(block->valid, start - block->range.start, end - start + 1);
+		}
+	}
+}
+
+/* Whether writing value at offset would leave the register unchanged */
+static bool reg_cache_write_is_redundant(struct lwis_i2c_device *i2c, uint64_t offset,
+					 uint64_t value)
+{
+	uint64_t cached_value;
+
+	return i2c->reg_cache_skip_redundant_writes && reg_cache_get(i2c, offset, &cached_value) &&
+	       cached_value == value;
+}
+
 int lwis_i2c_set_state(struct lwis_i2c_device *i2c, const char *state_str)
 {
 	int ret;
@@ -168,26 +302,16 @@ static int i2c_read(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *valu
 		return -EINVAL;
 	}
 
-	wbuf = kmalloc(offset_bytes, GFP_KERNEL);
-	if (!wbuf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c write buffer\n");
-		return -ENOMEM;
-	}
-
-	rbuf = kmalloc(value_bytes, GFP_KERNEL);
-	if (!rbuf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c read buffer\n");
-		ret = -ENOMEM;
-		goto error_rbuf_alloc;
-	}
+	wbuf = i2c->xfer_wbuf;
+	rbuf = i2c->xfer_rbuf;
 
 	msg[0].addr = client->addr;
-	msg[0].flags = 0;
+	msg[0].flags = I2C_M_DMA_SAFE;
 	msg[0].len = offset_bytes;
 	msg[0].buf = wbuf;
 
 	msg[1].addr = client->addr;
-	msg[1].flags = I2C_M_RD;
+	msg[1].flags = I2C_M_RD | I2C_M_DMA_SAFE;
 	msg[1].len = value_bytes;
 	msg[1].buf = rbuf;
 
@@ -195,23 +319,17 @@ static int i2c_read(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *valu
 
 	if (ret) {
 		dev_err(i2c->base_dev.dev, "I2C Read failed: Offset 0x%llx (%d)\n", offset, ret);
-		goto error_transfer;
+		return ret;
 	}
 
 	*value = buf_to_value(rbuf, value_bytes);
 
-error_transfer:
-	kfree(rbuf);
-error_rbuf_alloc:
-	kfree(wbuf);
-
-	return ret;
+	return 0;
 }
 
 static int i2c_write(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t value)
 {
 	int ret;
-	u8 *buf;
 	struct i2c_client *client;
 	struct i2c_msg msg;
 	unsigned int offset_bits;
@@ -246,15 +364,10 @@ static int i2c_write(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t valu
 	}
 
 	msg_bytes = offset_bytes + value_bytes;
-	buf = kmalloc(msg_bytes, GFP_KERNEL);
-	if (!buf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c buffer\n");
-		return -ENOMEM;
-	}
 
 	msg.addr = client->addr;
-	msg.flags = 0;
-	msg.buf = buf;
+	msg.flags = I2C_M_DMA_SAFE;
+	msg.buf = i2c->xfer_wbuf;
 	msg.len = msg_bytes;
 
 	ret = perform_write_transfer(client, &msg, offset, offset_bytes, value_bytes, value);
@@ -264,16 +377,17 @@ static int i2c_write(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t valu
 			offset, value, ret);
 	}
 
-	kfree(buf);
-
 	return ret;
 }
 
 static int i2c_read_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, uint8_t *read_buf,
-			  int read_buf_size)
+			  int read_buf_size, bool is_offset_fixed)
 {
 	int ret = 0;
-	uint8_t *wbuf;
+	int done;
+	int chunk;
+	int max_len = 0;
+	uint64_t offset;
 	struct i2c_client *client;
 	struct i2c_msg msg[2];
 	unsigned int offset_bits;
@@ -292,44 +406,208 @@ static int i2c_read_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, ui
 		return -EINVAL;
 	}
 
-	wbuf = kmalloc(offset_bytes, GFP_KERNEL);
-	if (!wbuf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c write buffer\n");
-		return -ENOMEM;
+	if (client->adapter->quirks) {
+		max_len = client->adapter->quirks->max_read_len;
 	}
 
 	msg[0].addr = client->addr;
-	msg[0].flags = 0;
+	msg[0].flags = I2C_M_DMA_SAFE;
 	msg[0].len = offset_bytes;
-	msg[0].buf = wbuf;
+	msg[0].buf = i2c->xfer_wbuf;
 
 	msg[1].addr = client->addr;
 	msg[1].flags = I2C_M_RD;
-	msg[1].len = read_buf_size;
-	msg[1].buf = read_buf;
 
-	ret = perform_read_transfer(client, msg, start_offset, offset_bytes);
+	/* Issue all the chunks back to back, without letting other devices on
+	   the bus in between */
+	i2c_lock_bus(client->adapter, I2C_LOCK_SEGMENT);
+	for (done = 0; done < read_buf_size; done += chunk) {
+		offset = is_offset_fixed ? start_offset : start_offset + done;
+		chunk = i2c_batch_chunk_size(i2c, offset, read_buf_size - done, max_len,
+					     is_offset_fixed);
+		msg[1].len = chunk;
+		msg[1].buf = read_buf + done;
+
+		ret = perform_read_batch_transfer(client, msg, offset, offset_bytes);
+		if (ret) {
+			dev_err(i2c->base_dev.dev, "I2C Read Batch failed: Offset 0x%llx (%d)\n",
+				offset, ret);
+			break;
+		}
+	}
+	i2c_unlock_bus(client->adapter, I2C_LOCK_SEGMENT);
 
-	if (ret) {
-		dev_err(i2c->base_dev.dev, "I2C Read Batch failed: Start Offset 0x%llx (%d)\n",
-			start_offset, ret);
+	return ret;
+}
+
+/* Called with the adapter lock held */
+static int i2c_write_batch_chunk(struct lwis_i2c_device *i2c, uint64_t offset,
+				 unsigned int offset_bytes, uint8_t *write_buf, int write_buf_size)
+{
+	int ret;
+	uint8_t *buf;
+	struct i2c_client *client = i2c->client;
+	struct i2c_msg msg[2];
+	int msg_bytes;
+
+	msg_bytes = offset_bytes + write_buf_size;
+
+	if (write_buf_size <= i2c->max_batch_size) {
+		/* Small payloads are cheaper to copy next to the offset header */
+		msg[0].addr = client->addr;
+		msg[0].flags = I2C_M_DMA_SAFE;
+		msg[0].buf = i2c->xfer_wbuf;
+		msg[0].len = msg_bytes;
+
+		return perform_write_batch_transfer(client, msg, offset, offset_bytes,
+						    write_buf_size, write_buf);
+	}
+
+	if (i2c_check_functionality(client->adapter, I2C_FUNC_NOSTART)) {
+		/* Gather the offset header and the payload in place */
+		msg[0].addr = client->addr;
+		msg[0].flags = I2C_M_DMA_SAFE;
+		msg[0].buf = i2c->xfer_wbuf;
+		msg[0].len = offset_bytes;
+
+		msg[1].addr = client->addr;
+		msg[1].flags = I2C_M_NOSTART;
+		msg[1].buf = write_buf;
+		msg[1].len = write_buf_size;
+
+		return perform_write_gather_transfer(client, msg, offset, offset_bytes);
 	}
 
-	kfree(wbuf);
+	buf = kmalloc(msg_bytes, GFP_KERNEL);
+	if (!buf) {
+		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c buffer\n");
+		return -ENOMEM;
+	}
+
+	msg[0].addr = client->addr;
+	msg[0].flags = 0;
+	msg[0].buf = buf;
+	msg[0].len = msg_bytes;
+
+	ret = perform_write_batch_transfer(client, msg, offset, offset_bytes, write_buf_size,
+					   write_buf);
+	kfree(buf);
 	return ret;
 }
 
 static int i2c_write_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, uint8_t *write_buf,
-			   int write_buf_size)
+			   int write_buf_size, bool is_offset_fixed)
+{
+	int ret = 0;
+	int done;
+	int chunk;
+	int max_len = 0;
+	uint64_t offset;
+	struct i2c_client *client;
+	unsigned int offset_bits;
+	unsigned int offset_bytes;
+
+	if (!i2c || !i2c->client) {
+		pr_err("Cannot find i2c instance\n");
+		return -ENODEV;
+	}
+	client = i2c->client;
+
+	if (i2c->base_dev.is_read_only) {
+		dev_err(i2c->base_dev.dev, "Device is read only\n");
+		return -EPERM;
+	}
+
+	offset_bits = i2c->base_dev.native_addr_bitwidth;
+	offset_bytes = offset_bits / BITS_PER_BYTE;
+	if (!check_bitwidth(offset_bits, MIN_OFFSET_BITS, MAX_OFFSET_BITS)) {
+		dev_err(i2c->base_dev.dev, "Invalid offset bitwidth %d\n", offset_bits);
+		return -EINVAL;
+	}
+
+	/* The offset header counts towards the adapter write length limit */
+	if (client->adapter->quirks && client->adapter->quirks->max_write_len) {
+		max_len = client->adapter->quirks->max_write_len - offset_bytes;
+		if (max_len <= 0) {
+			dev_err(i2c->base_dev.dev, "Adapter write length limit is too small\n");
+			return -EINVAL;
+		}
+	}
+
+	/* Issue all the chunks back to back, without letting other devices on
+	   the bus in between */
+	i2c_lock_bus(client->adapter, I2C_LOCK_SEGMENT);
+	for (done = 0; done < write_buf_size; done += chunk) {
+		offset = is_offset_fixed ? start_offset : start_offset + done;
+		chunk = i2c_batch_chunk_size(i2c, offset, write_buf_size - done, max_len,
+					     is_offset_fixed);
+
+		ret = i2c_write_batch_chunk(i2c, offset, offset_bytes, write_buf + done, chunk);
+		if (ret) {
+			dev_err(i2c->base_dev.dev, "I2C Write Batch failed: Offset 0x%llx (%d)\n",
+				offset, ret);
+			break;
+		}
+	}
+	i2c_unlock_bus(client->adapter, I2C_LOCK_SEGMENT);
+
+	return ret;
+}
+
+static int i2c_max_write_msgs(struct lwis_i2c_device *i2c, int max_msgs)
+{
+	const struct i2c_adapter_quirks *quirks = i2c->client->adapter->quirks;
+
+	if (quirks) {
+		/* Adapters restricted to combined or single messages can't take
+		   several writes in one transfer */
+		if (quirks->flags & (I2C_AQ_COMB | I2C_AQ_NO_REP_START)) {
+			return 1;
+		}
+		if (quirks->max_num_msgs) {
+			max_msgs = min_t(int, max_msgs, quirks->max_num_msgs);
+		}
+	}
+	return max_msgs;
+}
+
+/* Number of <write offset, read value> message pairs a transfer can hold */
+static int i2c_max_read_pairs(struct lwis_i2c_device *i2c)
+{
+	const struct i2c_adapter_quirks *quirks = i2c->client->adapter->quirks;
+	int max_pairs = i2c->num_xfer_msgs / 2;
+
+	if (quirks) {
+		if (quirks->flags & I2C_AQ_COMB) {
+			return 1;
+		}
+		if (quirks->max_num_msgs) {
+			max_pairs = min_t(int, max_pairs, quirks->max_num_msgs / 2);
+		}
+	}
+	return max(max_pairs, 1);
+}
+
+static int i2c_write_multi(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+			   int num_entries, int *num_written)
 {
 	int ret;
-	uint8_t *buf;
+	int i;
+	int start;
+	int done;
+	int num_msgs;
+	int max_msgs;
+	u8 *buf;
+	struct lwis_io_entry *entry;
 	struct i2c_client *client;
-	struct i2c_msg msg;
+	struct i2c_msg *msgs;
 	unsigned int offset_bits;
+	unsigned int value_bits;
 	unsigned int offset_bytes;
+	unsigned int value_bytes;
 	int msg_bytes;
 
+	*num_written = 0;
 	if (!i2c || !i2c->client) {
 		pr_err("Cannot find i2c instance\n");
 		return -ENODEV;
@@ -348,64 +626,437 @@ static int i2c_write_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, u
 		return -EINVAL;
 	}
 
-	msg_bytes = offset_bytes + write_buf_size;
-	buf = kmalloc(msg_bytes, GFP_KERNEL);
-	if (!buf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c buffer\n");
-		return -ENOMEM;
+	value_bits = i2c->base_dev.native_value_bitwidth;
+	value_bytes = value_bits / BITS_PER_BYTE;
+	if (!check_bitwidth(value_bits, MIN_DATA_BITS, MAX_DATA_BITS)) {
+		dev_err(i2c->base_dev.dev, "Invalid value bitwidth %d\n", value_bits);
+		return -EINVAL;
 	}
 
-	msg.addr = client->addr;
-	msg.flags = 0;
-	msg.buf = buf;
-	msg.len = msg_bytes;
+	msg_bytes = offset_bytes + value_bytes;
+	msgs = i2c->xfer_msgs;
+	max_msgs = i2c_max_write_msgs(i2c, i2c->batch_writes ? i2c->max_write_msgs : 1);
+
+	done = 0;
+	while (done < num_entries) {
+		start = done;
+		num_msgs = 0;
+		buf = i2c->xfer_wbuf;
+		while (done < num_entries && num_msgs < max_msgs) {
+			entry = &entries[done++];
+			if (reg_cache_write_is_redundant(i2c, entry->rw.offset, entry->rw.val)) {
+				continue;
+			}
+			value_to_buf(entry->rw.offset, buf, offset_bytes);
+			value_to_buf(entry->rw.val, buf + offset_bytes, value_bytes);
+			msgs[num_msgs].addr = client->addr;
+			msgs[num_msgs].flags = I2C_M_DMA_SAFE;
+			msgs[num_msgs].buf = buf;
+			msgs[num_msgs].len = msg_bytes;
+			buf += msg_bytes;
+			num_msgs++;
+			/* Cache the value as queued, so later writes in this chunk
+			   are compared against what the device will hold */
+			reg_cache_set(i2c, entry->rw.offset, entry->rw.val);
+		}
+		if (num_msgs == 0) {
+			continue;
+		}
 
-	ret = perform_write_batch_transfer(client, &msg, start_offset, offset_bytes, write_buf_size,
-					   write_buf);
+		ret = i2c_transfer(client->adapter, msgs, num_msgs);
+		if (ret != num_msgs) {
+			/* Any of the chunk's writes may not have landed */
+			for (i = start; i < done; ++i) {
+				reg_cache_invalidate_range(i2c, entries[i].rw.offset, 1);
+			}
+			dev_err(i2c->base_dev.dev,
+				"I2C Write failed: Offset 0x%llx, %d registers (%d)\n",
+				entries[start].rw.offset, num_msgs, ret);
+			/* With one message per transfer, the entries skipped as
+			   redundant before the failed one are already in place.
+			   Otherwise it is unknown which messages of the chunk
+			   landed. */
+			*num_written = (max_msgs == 1) ? done - 1 : start;
+			return (ret < 0) ? ret : -EIO;
+		}
+		*num_written = done;
+	}
 
-	if (ret) {
-		dev_err(i2c->base_dev.dev, "I2C Write Batch failed: Start Offset 0x%llx (%d)\n",
-			start_offset, ret);
+	return 0;
+}
+
+/*
+ * Reads a FIFO register of a device that auto-increments the offset, one value
+ * at a time, pipelining as many reads as possible in each transfer.
+ */
+static int i2c_read_fifo(struct lwis_i2c_device *i2c, uint64_t offset, uint8_t *read_buf,
+			 int read_buf_size)
+{
+	int ret;
+	int i;
+	int done;
+	int num_values;
+	int num_pairs;
+	int max_pairs;
+	struct i2c_client *client;
+	struct i2c_msg *msgs;
+	unsigned int offset_bits;
+	unsigned int value_bits;
+	unsigned int offset_bytes;
+	unsigned int value_bytes;
+
+	if (!i2c || !i2c->client) {
+		pr_err("Cannot find i2c instance\n");
+		return -ENODEV;
 	}
+	client = i2c->client;
 
-	kfree(buf);
+	offset_bits = i2c->base_dev.native_addr_bitwidth;
+	offset_bytes = offset_bits / BITS_PER_BYTE;
+	if (!check_bitwidth(offset_bits, MIN_OFFSET_BITS, MAX_OFFSET_BITS)) {
+		dev_err(i2c->base_dev.dev, "Invalid offset bitwidth %d\n", offset_bits);
+		return -EINVAL;
+	}
 
-	return ret;
+	value_bits = i2c->base_dev.native_value_bitwidth;
+	value_bytes = value_bits / BITS_PER_BYTE;
+	if (!check_bitwidth(value_bits, MIN_DATA_BITS, MAX_DATA_BITS)) {
+		dev_err(i2c->base_dev.dev, "Invalid value bitwidth %d\n", value_bits);
+		return -EINVAL;
+	}
+
+	if (read_buf_size % value_bytes) {
+		dev_err(i2c->base_dev.dev, "FIFO read size %d is not a multiple of %u bytes\n",
+			read_buf_size, value_bytes);
+		return -EINVAL;
+	}
+
+	/* Every read is preceded by the same offset */
+	value_to_buf(offset, i2c->xfer_wbuf, offset_bytes);
+	msgs = i2c->xfer_msgs;
+	max_pairs = i2c_max_read_pairs(i2c);
+	num_values = read_buf_size / value_bytes;
+
+	for (done = 0; done < num_values; done += num_pairs) {
+		num_pairs = min(num_values - done, max_pairs);
+		for (i = 0; i < num_pairs; ++i) {
+			msgs[2 * i].addr = client->addr;
+			msgs[2 * i].flags = I2C_M_DMA_SAFE;
+			msgs[2 * i].len = offset_bytes;
+			msgs[2 * i].buf = i2c->xfer_wbuf;
+
+			msgs[2 * i + 1].addr = client->addr;
+			msgs[2 * i + 1].flags = I2C_M_RD;
+			msgs[2 * i + 1].len = value_bytes;
+			msgs[2 * i + 1].buf = read_buf + (done + i) * value_bytes;
+		}
+
+		ret = i2c_transfer(client->adapter, msgs, 2 * num_pairs);
+		if (ret != 2 * num_pairs) {
+			dev_err(i2c->base_dev.dev, "I2C FIFO Read failed: Offset 0x%llx (%d)\n",
+				offset, ret);
+			return (ret < 0) ? ret : -EIO;
+		}
+	}
+
+	return 0;
 }
 
-int lwis_i2c_io_entry_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entry)
+/*
+ * Writes a FIFO register of a device that auto-increments the offset, one value
+ * per message, packing as many messages as possible in each transfer.
+ */
+static int i2c_write_fifo(struct lwis_i2c_device *i2c, uint64_t offset, uint8_t *write_buf,
+			  int write_buf_size)
 {
 	int ret;
-	uint64_t reg_value;
+	int i;
+	int done;
+	int num_values;
+	int num_msgs;
+	int max_msgs;
+	u8 *buf;
+	struct i2c_client *client;
+	struct i2c_msg *msgs;
+	unsigned int offset_bits;
+	unsigned int value_bits;
+	unsigned int offset_bytes;
+	unsigned int value_bytes;
+	int msg_bytes;
 
-	if (!entry) {
-		dev_err(i2c->base_dev.dev, "IO entry is NULL.\n");
+	if (!i2c || !i2c->client) {
+		pr_err("Cannot find i2c instance\n");
+		return -ENODEV;
+	}
+	client = i2c->client;
+
+	if (i2c->base_dev.is_read_only) {
+		dev_err(i2c->base_dev.dev, "Device is read only\n");
+		return -EPERM;
+	}
+
+	offset_bits = i2c->base_dev.native_addr_bitwidth;
+	offset_bytes = offset_bits / BITS_PER_BYTE;
+	if (!check_bitwidth(offset_bits, MIN_OFFSET_BITS, MAX_OFFSET_BITS)) {
+		dev_err(i2c->base_dev.dev, "Invalid offset bitwidth %d\n", offset_bits);
 		return -EINVAL;
 	}
 
+	value_bits = i2c->base_dev.native_value_bitwidth;
+	value_bytes = value_bits / BITS_PER_BYTE;
+	if (!check_bitwidth(value_bits, MIN_DATA_BITS, MAX_DATA_BITS)) {
+		dev_err(i2c->base_dev.dev, "Invalid value bitwidth %d\n", value_bits);
+		return -EINVAL;
+	}
+
+	if (write_buf_size % value_bytes) {
+		dev_err(i2c->base_dev.dev, "FIFO write size %d is not a multiple of %u bytes\n",
+			write_buf_size, value_bytes);
+		return -EINVAL;
+	}
+
+	msg_bytes = offset_bytes + value_bytes;
+	msgs = i2c->xfer_msgs;
+	max_msgs = i2c_max_write_msgs(i2c, i2c->max_write_msgs);
+	num_values = write_buf_size / value_bytes;
+
+	for (done = 0; done < num_values; done += num_msgs) {
+		num_msgs = min(num_values - done, max_msgs);
+		buf = i2c->xfer_wbuf;
+		for (i = 0; i < num_msgs; ++i) {
+			value_to_buf(offset, buf, offset_bytes);
+			memcpy(buf + offset_bytes, write_buf + (done + i) * value_bytes,
+			       value_bytes);
+			msgs[i].addr = client->addr;
+			msgs[i].flags = I2C_M_DMA_SAFE;
+			msgs[i].buf = buf;
+			msgs[i].len = msg_bytes;
+			buf += msg_bytes;
+		}
+
+		ret = i2c_transfer(client->adapter, msgs, num_msgs);
+		if (ret != num_msgs) {
+			dev_err(i2c->base_dev.dev, "I2C FIFO Write failed: Offset 0x%llx (%d)\n",
+				offset, ret);
+			return (ret < 0) ? ret : -EIO;
+		}
+	}
+
+	return 0;
+}
+
+int lwis_i2c_xfer_buffers_alloc(struct lwis_i2c_device *i2c)
+{
+	unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
+	unsigned int value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
+
+	/* Single register writes go through the batch buffer as well */
+	i2c->max_batch_size = max_t(u32, i2c->max_batch_size, value_bytes);
+
+	/* kmalloc'ed memory is DMA-safe for the i2c controllers */
+	i2c->xfer_wbuf = kmalloc(offset_bytes + i2c->max_batch_size, GFP_KERNEL);
+	if (!i2c->xfer_wbuf) {
+		return -ENOMEM;
+	}
+
+	i2c->xfer_rbuf = kmalloc(value_bytes, GFP_KERNEL);
+	if (!i2c->xfer_rbuf) {
+		kfree(i2c->xfer_wbuf);
+		i2c->xfer_wbuf = NULL;
+		return -ENOMEM;
+	}
+
+	/* As many register writes as fit in xfer_wbuf can share a transfer */
+	i2c->max_write_msgs = 1;
+	if (offset_bytes + value_bytes > 0) {
+		i2c->max_write_msgs =
+			(offset_bytes + i2c->max_batch_size) / (offset_bytes + value_bytes);
+	}
+	/* At least one <write offset, read value> pair */
+	i2c->num_xfer_msgs = max(i2c->max_write_msgs, 2);
+	i2c->xfer_msgs = kcalloc(i2c->num_xfer_msgs, sizeof(struct i2c_msg), GFP_KERNEL);
+	if (!i2c->xfer_msgs) {
+		lwis_i2c_xfer_buffers_free(i2c);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+int lwis_i2c_reg_cache_alloc(struct lwis_i2c_device *i2c)
+{
+	struct lwis_i2c_reg_cache_block *block;
+	u32 num_regs;
+	int i;
+
+	for (i = 0; i < i2c->num_reg_cache_blocks; ++i) {
+		block = &i2c->reg_cache[i];
+		num_regs = block->range.end - block->range.start + 1;
+		block->values = kvmalloc_array(num_regs, sizeof(u32), GFP_KERNEL);
+		block->valid = bitmap_zalloc(num_regs, GFP_KERNEL);
+		if (!block->values || !block->valid) {
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+void lwis_i2c_reg_cache_free(struct lwis_i2c_device *i2c)
+{
+	int i;
+
+	for (i = 0; i < i2c->num_reg_cache_blocks; ++i) {
+		kvfree(i2c->reg_cache[i].values);
+		bitmap_free(i2c->reg_cache[i].valid);
+	}
+	kfree(i2c->reg_cache);
+	i2c->reg_cache = NULL;
+	i2c->num_reg_cache_blocks = 0;
+	kfree(i2c->volatile_regs);
+	i2c->volatile_regs = NULL;
+	i2c->num_volatile_regs = 0;
+}
+
+void lwis_i2c_reg_cache_invalidate(struct lwis_i2c_device *i2c)
+{
+	int i;
+
+	mutex_lock(&i2c->io_lock);
+	for (i = 0; i < i2c->num_reg_cache_blocks; ++i) {
+		bitmap_zero(i2c->reg_cache[i].valid,
+			    i2c->reg_cache[i].range.end - i2c->reg_cache[i].range.start + 1);
+	}
+	mutex_unlock(&i2c->io_lock);
+}
+
+void lwis_i2c_xfer_buffers_free(struct lwis_i2c_device *i2c)
+{
+	kfree(i2c->xfer_wbuf);
+	i2c->xfer_wbuf = NULL;
+	kfree(i2c->xfer_rbuf);
+	i2c->xfer_rbuf = NULL;
+	kfree(i2c->xfer_msgs);
+	i2c->xfer_msgs = NULL;
+}
+
+static int i2c_write_cached(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t value)
+{
+	int ret;
+
+	if (reg_cache_write_is_redundant(i2c, offset, value)) {
+		return 0;
+	}
+
+	ret = i2c_write(i2c, offset, value);
+	if (ret) {
+		/* The register may or may not have been written */
+		reg_cache_invalidate_range(i2c, offset, 1);
+		return ret;
+	}
+	reg_cache_set(i2c, offset, value);
+	return 0;
+}
+
+static int i2c_io_entry_rw_locked(struct lwis_i2c_device *i2c, struct lwis_io_entry *entry)
+{
+	int ret;
+	uint64_t reg_value;
+
 	if (entry->type == LWIS_IO_ENTRY_READ) {
-		return i2c_read(i2c, entry->rw.offset, &entry->rw.val);
+		ret = i2c_read(i2c, entry->rw.offset, &entry->rw.val);
+		if (!ret) {
+			reg_cache_set(i2c, entry->rw.offset, entry->rw.val);
+		}
+		return ret;
 	}
 	if (entry->type == LWIS_IO_ENTRY_WRITE) {
-		return i2c_write(i2c, entry->rw.offset, entry->rw.val);
+		return i2c_write_cached(i2c, entry->rw.offset, entry->rw.val);
 	}
 	if (entry->type == LWIS_IO_ENTRY_MODIFY) {
-		ret = i2c_read(i2c, entry->mod.offset, &reg_value);
-		if (ret) {
-			return ret;
+		/* Only read the register back if its value is not known */
+		if (!reg_cache_get(i2c, entry->mod.offset, &reg_value)) {
+			ret = i2c_read(i2c, entry->mod.offset, &reg_value);
+			if (ret) {
+				return ret;
+			}
+			reg_cache_set(i2c, entry->mod.offset, reg_value);
 		}
 		reg_value &= ~entry->mod.val_mask;
 		reg_value |= entry->mod.val_mask & entry->mod.val;
-		return i2c_write(i2c, entry->mod.offset, reg_value);
+		return i2c_write_cached(i2c, entry->mod.offset, reg_value);
 	}
 	if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
+		/* Devices streaming their FIFO take the same transfer as a burst read */
+		if (entry->rw_batch.is_offset_fixed && !i2c->fifo_streaming) {
+			return i2c_read_fifo(i2c, entry->rw_batch.offset, entry->rw_batch.buf,
+					     entry->rw_batch.size_in_bytes);
+		}
 		return i2c_read_batch(i2c, entry->rw_batch.offset, entry->rw_batch.buf,
-				      entry->rw_batch.size_in_bytes);
+				      entry->rw_batch.size_in_bytes, entry->rw_batch.is_offset_fixed);
 	}
 	if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+		if (entry->rw_batch.is_offset_fixed) {
+			reg_cache_invalidate_range(i2c, entry->rw_batch.offset, 1);
+			if (!i2c->fifo_streaming) {
+				return i2c_write_fifo(i2c, entry->rw_batch.offset,
+						      entry->rw_batch.buf,
+						      entry->rw_batch.size_in_bytes);
+			}
+		} else {
+			/* The batch may cover cached registers, whatever their width */
+			reg_cache_invalidate_range(i2c, entry->rw_batch.offset,
+						   entry->rw_batch.size_in_bytes);
+		}
 		return i2c_write_batch(i2c, entry->rw_batch.offset, entry->rw_batch.buf,
-				       entry->rw_batch.size_in_bytes);
+				       entry->rw_batch.size_in_bytes, entry->rw_batch.is_offset_fixed);
 	}
 	dev_err(i2c->base_dev.dev, "Invalid IO entry type: %d\n", entry->type);
 	return -EINVAL;
 }
+
+int lwis_i2c_io_entries_write(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+			      int num_entries, int *num_written)
+{
+	int ret;
+
+	*num_written = 0;
+	if (!entries) {
+		dev_err(i2c->base_dev.dev, "IO entries are NULL.\n");
+		return -EINVAL;
+	}
+
+	if (i2c->bus_sched) {
+		lwis_i2c_sched_acquire(i2c->bus_sched, i2c);
+	}
+	mutex_lock(&i2c->io_lock);
+	ret = i2c_write_multi(i2c, entries, num_entries, num_written);
+	mutex_unlock(&i2c->io_lock);
+	if (i2c->bus_sched) {
+		lwis_i2c_sched_release(i2c->bus_sched, i2c);
+	}
+	return ret;
+}
+
+int lwis_i2c_io_entry_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entry)
+{
+	int ret;
+
+	if (!entry) {
+		dev_err(i2c->base_dev.dev, "IO entry is NULL.\n");
+		return -EINVAL;
+	}
+
+	/* Wait for the device's turn on the bus before taking io_lock, so that
+	   several requests of the device can queue up and be served together */
+	if (i2c->bus_sched) {
+		lwis_i2c_sched_acquire(i2c->bus_sched, i2c);
+	}
+	/* The transfer buffers are shared by all the users of the device */
+	mutex_lock(&i2c->io_lock);
+	ret = i2c_io_entry_rw_locked(i2c, entry);
+	mutex_unlock(&i2c->io_lock);
+	if (i2c->bus_sched) {
+		lwis_i2c_sched_release(i2c->bus_sched, i2c);
+	}
+	return ret;
+}
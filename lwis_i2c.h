@@ -29,6 +29,44 @@
  */
 int lwis_i2c_set_state(struct lwis_i2c_device *i2c, const char *state_str);
 
+/*
+ *  lwis_i2c_xfer_buffers_alloc: Allocate the transfer buffers used for
+ *  register access, sized from the device bitwidths and max_batch_size.
+ */
+int lwis_i2c_xfer_buffers_alloc(struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_xfer_buffers_free: Free the transfer buffers.
+ */
+void lwis_i2c_xfer_buffers_free(struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_reg_cache_alloc: Allocate the register shadow cache storage for
+ *  the cacheable ranges parsed from the device tree.
+ */
+int lwis_i2c_reg_cache_alloc(struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_reg_cache_free: Free the register shadow cache and its ranges.
+ */
+void lwis_i2c_reg_cache_free(struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_reg_cache_invalidate: Forget all the cached register values, e.g.
+ *  when the device loses power.
+ */
+void lwis_i2c_reg_cache_invalidate(struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_io_entries_write: Write a run of LWIS_IO_ENTRY_WRITE entries.
+ *  If batch_writes is set, they are packed into as few i2c transfers as the
+ *  adapter allows, one message per register. *num_written is set to the
+ *  number of leading entries known to have reached the device, which on error
+ *  is the start of the failed transfer.
+ */
+int lwis_i2c_io_entries_write(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+			      int num_entries, int *num_written);
+
 /*
  *  lwis_i2c_io_entry_rw: Read/Write from i2c bus via io_entry request.
  *  The readback values will be stored in the entry.
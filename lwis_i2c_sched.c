@@ -0,0 +1,156 @@
+/*
+ * Google LWIS I2C Bus Transfer Scheduler
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-i2c-sched: " fmt
+
+#include "lwis_i2c_sched.h"
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include "lwis_device_i2c.h"
+#include "lwis_util.h"
+
+void lwis_i2c_sched_init(struct lwis_i2c_sched *sched)
+{
+	int i;
+
+	spin_lock_init(&sched->lock);
+	sched->owner = NULL;
+	sched->owner_run = 0;
+	for (i = 0; i < LWIS_I2C_SCHED_NUM_PRIORITIES; ++i) {
+		INIT_LIST_HEAD(&sched->queues[i]);
+	}
+	memset(&sched->stats, 0, sizeof(sched->stats));
+}
+
+/*
+ * Returns the oldest request that has waited past LWIS_I2C_SCHED_MAX_WAIT_NS,
+ * or NULL if none has. Queues are FIFOs, so only their heads are checked.
+ * Called with sched->lock held.
+ */
+static struct lwis_i2c_sched_request *sched_find_aged_locked(struct lwis_i2c_sched *sched)
+{
+	struct lwis_i2c_sched_request *request, *oldest = NULL;
+	ktime_t deadline = ktime_sub_ns(lwis_get_time(), LWIS_I2C_SCHED_MAX_WAIT_NS);
+	int i;
+
+	for (i = 0; i < LWIS_I2C_SCHED_NUM_PRIORITIES; ++i) {
+		request = list_first_entry_or_null(&sched->queues[i], struct lwis_i2c_sched_request,
+						   node);
+		if (request && ktime_before(request->enqueue_time, deadline) &&
+		    (!oldest || ktime_before(request->enqueue_time, oldest->enqueue_time))) {
+			oldest = request;
+		}
+	}
+	return oldest;
+}
+
+/*
+ * Picks the request to serve after prev_owner is done with the bus: the
+ * oldest request that waited too long if any, otherwise the oldest one of the
+ * highest priority, unless prev_owner has another request of that priority
+ * waiting and has not used up its run of back to back grants.
+ * Called with sched->lock held.
+ */
+static struct lwis_i2c_sched_request *sched_pick_next_locked(struct lwis_i2c_sched *sched,
+							     struct lwis_i2c_device *prev_owner)
+{
+	struct lwis_i2c_sched_request *request;
+	struct list_head *queue;
+	int i;
+
+	request = sched_find_aged_locked(sched);
+	if (request) {
+		sched->owner_run = 0;
+		sched->stats.aged_count++;
+		return request;
+	}
+
+	for (i = 0; i < LWIS_I2C_SCHED_NUM_PRIORITIES; ++i) {
+		queue = &sched->queues[i];
+		if (list_empty(queue)) {
+			continue;
+		}
+		if (sched->owner_run < LWIS_I2C_SCHED_MAX_OWNER_RUN) {
+			list_for_each_entry (request, queue, node) {
+				if (request->i2c == prev_owner) {
+					sched->owner_run++;
+					sched->stats.back_to_back_count++;
+					return request;
+				}
+			}
+		}
+		sched->owner_run = 0;
+		return list_first_entry(queue, struct lwis_i2c_sched_request, node);
+	}
+	return NULL;
+}
+
+void lwis_i2c_sched_acquire(struct lwis_i2c_sched *sched, struct lwis_i2c_device *i2c)
+{
+	struct lwis_i2c_sched_request request;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	sched->stats.request_count++;
+	if (sched->owner == NULL) {
+		sched->owner = i2c;
+		sched->owner_run = 0;
+		spin_unlock_irqrestore(&sched->lock, flags);
+		return;
+	}
+
+	request.i2c = i2c;
+	init_completion(&request.granted);
+	request.enqueue_time = lwis_get_time();
+	list_add_tail(&request.node, &sched->queues[i2c->transfer_priority]);
+	sched->stats.wait_count++;
+	sched->stats.queue_depth++;
+	sched->stats.max_queue_depth =
+		max(sched->stats.max_queue_depth, sched->stats.queue_depth);
+	spin_unlock_irqrestore(&sched->lock, flags);
+
+	/* The releasing owner dequeues the request before granting it */
+	wait_for_completion(&request.granted);
+}
+
+void lwis_i2c_sched_release(struct lwis_i2c_sched *sched, struct lwis_i2c_device *i2c)
+{
+	struct lwis_i2c_sched_request *next;
+	uint64_t wait_ns;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	next = sched_pick_next_locked(sched, i2c);
+	if (next == NULL) {
+		sched->owner = NULL;
+		spin_unlock_irqrestore(&sched->lock, flags);
+		return;
+	}
+
+	list_del(&next->node);
+	sched->stats.queue_depth--;
+	wait_ns = ktime_to_ns(ktime_sub(lwis_get_time(), next->enqueue_time));
+	sched->stats.total_wait_ns += wait_ns;
+	sched->stats.max_wait_ns = max(sched->stats.max_wait_ns, wait_ns);
+	sched->owner = next->i2c;
+	complete(&next->granted);
+	spin_unlock_irqrestore(&sched->lock, flags);
+}
+
+void lwis_i2c_sched_get_stats(struct lwis_i2c_sched *sched, struct lwis_i2c_sched_stats *stats)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	*stats = sched->stats;
+	spin_unlock_irqrestore(&sched->lock, flags);
+}
@@ -0,0 +1,101 @@
+/*
+ * Google LWIS I2C Bus Transfer Scheduler
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_I2C_SCHED_H_
+#define LWIS_I2C_SCHED_H_
+
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+/* Transfer priorities, lower values are served first */
+#define LWIS_I2C_SCHED_PRIORITY_CRITICAL 0
+#define LWIS_I2C_SCHED_PRIORITY_NORMAL 1
+#define LWIS_I2C_SCHED_PRIORITY_BACKGROUND 2
+#define LWIS_I2C_SCHED_NUM_PRIORITIES 3
+
+/* Max number of back to back grants to the same device while other devices
+ * of the same priority are waiting */
+#define LWIS_I2C_SCHED_MAX_OWNER_RUN 8
+
+/* A request waiting longer than this is served before any higher priority
+ * one, so background and normal devices can't be starved */
+#define LWIS_I2C_SCHED_MAX_WAIT_NS (20 * NSEC_PER_MSEC)
+
+struct lwis_i2c_device;
+
+/*
+ * struct lwis_i2c_sched_request
+ * A register access waiting for its turn on the bus.
+ */
+struct lwis_i2c_sched_request {
+	struct lwis_i2c_device *i2c;
+	/* Completed when the request owns the bus */
+	struct completion granted;
+	ktime_t enqueue_time;
+	struct list_head node;
+};
+
+struct lwis_i2c_sched_stats {
+	/* Number of register accesses scheduled */
+	uint64_t request_count;
+	/* Number of accesses that had to wait for the bus */
+	uint64_t wait_count;
+	/* Number of accesses granted right after one from the same device */
+	uint64_t back_to_back_count;
+	/* Number of accesses granted ahead of their priority after waiting too long */
+	uint64_t aged_count;
+	uint64_t total_wait_ns;
+	uint64_t max_wait_ns;
+	unsigned int queue_depth;
+	unsigned int max_queue_depth;
+};
+
+/*
+ * struct lwis_i2c_sched
+ * Arbitrates the register accesses of the I2C devices sharing a lock group.
+ */
+struct lwis_i2c_sched {
+	spinlock_t lock;
+	/* Device currently owning the bus, NULL if idle */
+	struct lwis_i2c_device *owner;
+	/* Number of consecutive grants to the current owner */
+	int owner_run;
+	/* Waiting requests, one FIFO per priority */
+	struct list_head queues[LWIS_I2C_SCHED_NUM_PRIORITIES];
+	struct lwis_i2c_sched_stats stats;
+};
+
+/*
+ *  lwis_i2c_sched_init: Initialize an idle scheduler.
+ */
+void lwis_i2c_sched_init(struct lwis_i2c_sched *sched);
+
+/*
+ *  lwis_i2c_sched_acquire: Wait until i2c may access the bus. Higher priority
+ *  requests are served first, unless a lower priority one has waited longer
+ *  than LWIS_I2C_SCHED_MAX_WAIT_NS, and requests from the device that just
+ *  used the bus are kept together. Transfers are not merged, each request
+ *  still does its own i2c_transfer().
+ */
+void lwis_i2c_sched_acquire(struct lwis_i2c_sched *sched, struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_sched_release: Hand the bus over to the next waiting request.
+ */
+void lwis_i2c_sched_release(struct lwis_i2c_sched *sched, struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_sched_get_stats: Copy a snapshot of the scheduler statistics.
+ */
+void lwis_i2c_sched_get_stats(struct lwis_i2c_sched *sched, struct lwis_i2c_sched_stats *stats);
+
+#endif /* LWIS_I2C_SCHED_H_ */
@@ -12,7 +12,12 @@
 
 #include "lwis_interrupt.h"
 
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+#include <linux/irq.h>
 #include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
 
 #include "lwis_device.h"
@@ -28,20 +33,30 @@ struct lwis_single_event_info {
 	int int_reg_bit;
 	/* If critical, print during ISR */
 	bool is_critical;
+	/* If a client asked for the interrupt to be masked after it fires once */
+	bool enable_once;
 	/* Reference to the device event state */
 	struct lwis_device_event_state *state;
 	/* Node in the lwis_interrupt->event_infos hash table */
 	struct hlist_node node;
 	/* Node in the lwis_interrupt->enabled_event_infos list */
 	struct list_head node_enabled;
+	/* Next enabled event on the same bit in lwis_interrupt->enabled_events_by_bit.
+	 * Event infos live as long as the interrupt list, so a reader that is
+	 * still on an event being disabled can follow it without a grace period */
+	struct lwis_single_event_info *next_enabled_same_bit;
 };
 
 static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data);
+static irqreturn_t lwis_interrupt_event_thread(int irq_number, void *data);
 static irqreturn_t lwis_interrupt_gpios_event_isr(int irq_number, void *data);
+static irqreturn_t lwis_interrupt_gpios_event_thread(int irq_number, void *data);
+static void lwis_interrupt_storm_work(struct work_struct *work);
 
 struct lwis_interrupt_list *lwis_interrupt_list_alloc(struct lwis_device *lwis_dev, int count)
 {
 	struct lwis_interrupt_list *list;
+	int i;
 
 	/* No need to allocate if count is invalid */
 	if (count <= 0) {
@@ -63,6 +78,19 @@ struct lwis_interrupt_list *lwis_interrupt_list_alloc(struct lwis_device *lwis_d
 
 	list->count = count;
 	list->lwis_dev = lwis_dev;
+	atomic_set(&list->mask_batch_depth, 0);
+
+	/* Storm detection stays off unless the device tree sets a threshold */
+	for (i = 0; i < count; ++i) {
+		list->irq[i].storm_threshold = 0;
+		list->irq[i].storm_window_ns =
+			(int64_t)LWIS_INTERRUPT_STORM_DEFAULT_WINDOW_MS * NSEC_PER_MSEC;
+		list->irq[i].storm_cooldown_ns =
+			(int64_t)LWIS_INTERRUPT_STORM_DEFAULT_COOLDOWN_MS * NSEC_PER_MSEC;
+		list->irq[i].throttled_bits = 0;
+		memset(list->irq[i].bit_stats, 0, sizeof(list->irq[i].bit_stats));
+		INIT_DELAYED_WORK(&list->irq[i].storm_work, lwis_interrupt_storm_work);
+	}
 
 	return list;
 }
@@ -80,7 +108,10 @@ void lwis_interrupt_list_free(struct lwis_interrupt_list *list)
 	}
 
 	for (i = 0; i < list->count; ++i) {
+		/* The IRQ core must not keep a hint into the list being freed */
+		irq_set_affinity_hint(list->irq[i].irq, NULL);
 		free_irq(list->irq[i].irq, &list->irq[i]);
+		cancel_delayed_work_sync(&list->irq[i].storm_work);
 	}
 	kfree(list->irq);
 }
@@ -109,9 +140,13 @@ int lwis_interrupt_get(struct lwis_interrupt_list *list, int index, char *name,
 		 list->lwis_dev->name, name);
 	list->irq[index].has_events = false;
 	list->irq[index].lwis_dev = list->lwis_dev;
+	INIT_KFIFO(list->irq[index].latched);
+	list->irq[index].overflow_status = 0;
+	list->irq[index].overflow_timestamp = 0;
+	list->irq[index].latch_overflows = 0;
 
-	ret = request_irq(irq, lwis_interrupt_event_isr, IRQF_SHARED, list->irq[index].full_name,
-			  &list->irq[index]);
+	ret = request_threaded_irq(irq, lwis_interrupt_event_isr, lwis_interrupt_event_thread,
+				   IRQF_SHARED, list->irq[index].full_name, &list->irq[index]);
 	if (ret) {
 		dev_err(list->lwis_dev->dev, "Failed to request IRQ %d\n", irq);
 		return ret;
@@ -142,9 +177,14 @@ int lwis_interrupt_get_gpio_irq(struct lwis_interrupt_list *list, int index, cha
 		 list->lwis_dev->name, name);
 	list->irq[index].has_events = false;
 	list->irq[index].lwis_dev = list->lwis_dev;
-
-	ret = request_irq(gpio_irq, lwis_interrupt_gpios_event_isr, IRQF_SHARED,
-			  list->irq[index].full_name, &list->irq[index]);
+	INIT_KFIFO(list->irq[index].latched);
+	list->irq[index].overflow_status = 0;
+	list->irq[index].overflow_timestamp = 0;
+	list->irq[index].latch_overflows = 0;
+
+	ret = request_threaded_irq(gpio_irq, lwis_interrupt_gpios_event_isr,
+				   lwis_interrupt_gpios_event_thread, IRQF_SHARED,
+				   list->irq[index].full_name, &list->irq[index]);
 	if (ret) {
 		dev_err(list->lwis_dev->dev, "Failed to request GPIO IRQ\n");
 		return ret;
@@ -179,91 +219,160 @@ lwis_interrupt_get_single_event_info_locked(struct lwis_interrupt *irq, int64_t
 	return NULL;
 }
 
-static int lwis_interrupt_set_mask(struct lwis_interrupt *irq, int int_reg_bit, bool is_set)
+static int mask_flush_locked(struct lwis_interrupt *irq)
+{
+	int ret;
+
+	ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid, irq->irq_mask_reg,
+						irq->mask_shadow, irq->irq_reg_access_size);
+	if (ret) {
+		pr_err("Failed to write IRQ mask register: %d\n", ret);
+		return ret;
+	}
+	irq->mask_dirty = false;
+	return 0;
+}
+
+/*
+ * Called with irq->lock held. Unless flush_now is set, the register write is
+ * left to lwis_interrupt_mask_batch_end while a batch is open. The interrupt
+ * handling paths must not wait on a batch opened by some client, so they
+ * flush right away, which also writes any change deferred by the batch.
+ */
+static int lwis_interrupt_set_mask_bits(struct lwis_interrupt *irq, uint64_t bits, bool is_set,
+					bool flush_now)
 {
 	int ret = 0;
-	uint64_t mask_value = 0;
 
 	if (!irq) {
 		pr_err("irq is NULL.\n");
 		return -EINVAL;
 	}
 
-	/* Read the mask register */
-	ret = lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid, irq->irq_mask_reg,
-					       &mask_value, irq->irq_reg_access_size);
-	if (ret) {
-		pr_err("Failed to read IRQ mask register: %d\n", ret);
-		return ret;
+	/* Read the mask register, only once after each power-up */
+	if (!irq->mask_shadow_valid) {
+		ret = lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid,
+						       irq->irq_mask_reg, &irq->mask_shadow,
+						       irq->irq_reg_access_size);
+		if (ret) {
+			pr_err("Failed to read IRQ mask register: %d\n", ret);
+			return ret;
+		}
+		irq->mask_shadow_valid = true;
 	}
 
 	/* Unmask the interrupt */
 	if (is_set) {
-		mask_value |= (1ULL << int_reg_bit);
+		irq->mask_shadow |= bits;
 	} else {
-		mask_value &= ~(1ULL << int_reg_bit);
+		irq->mask_shadow &= ~bits;
 	}
 
-	/* Write the mask register */
-	ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid, irq->irq_mask_reg,
-						mask_value, irq->irq_reg_access_size);
-	if (ret) {
-		pr_err("Failed to write IRQ mask register: %d\n", ret);
-		return ret;
+	/* Leave the write to lwis_interrupt_mask_batch_end */
+	if (!flush_now && atomic_read(&irq->lwis_dev->irqs->mask_batch_depth) > 0) {
+		irq->mask_dirty = true;
+		return 0;
 	}
 
-	return ret;
+	/* Write the mask register */
+	return mask_flush_locked(irq);
 }
 
-static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
+static int lwis_interrupt_set_mask(struct lwis_interrupt *irq, int int_reg_bit, bool is_set)
+{
+	return lwis_interrupt_set_mask_bits(irq, 1ULL << int_reg_bit, is_set, /*flush_now=*/false);
+}
+
+/*
+ * Counts the bits of one latched interrupt towards their storm budget.
+ * Returns the bits that just exceeded it, which the caller masks.
+ */
+static uint64_t storm_check_locked(struct lwis_interrupt *irq, uint64_t source_value,
+				   int64_t timestamp)
+{
+	DECLARE_BITMAP(fired, LWIS_INTERRUPT_MAX_REG_BITS);
+	struct lwis_interrupt_bit_stats *stats;
+	unsigned int bit;
+	uint64_t storm_value = 0;
+
+	bitmap_from_u64(fired, source_value);
+	for_each_set_bit (bit, fired, LWIS_INTERRUPT_MAX_REG_BITS) {
+		stats = &irq->bit_stats[bit];
+		stats->total_count++;
+		if (irq->storm_threshold == 0 || (irq->throttled_bits & (1ULL << bit))) {
+			continue;
+		}
+		if (timestamp - stats->window_start_ns >= irq->storm_window_ns) {
+			stats->window_start_ns = timestamp;
+			stats->window_count = 0;
+		}
+		if (++stats->window_count > irq->storm_threshold) {
+			stats->throttle_count++;
+			stats->throttled_until_ns = timestamp + irq->storm_cooldown_ns;
+			storm_value |= (1ULL << bit);
+		}
+	}
+	irq->throttled_bits |= storm_value;
+	return storm_value;
+}
+
+/*
+ * Emits the events of one latched interrupt. Runs in the IRQ thread, the
+ * register bookkeeping is done under irq->lock and the per-bit event chains
+ * are then walked under RCU, so the client fan-out runs with IRQs enabled.
+ */
+static void lwis_interrupt_dispatch(struct lwis_interrupt *irq, uint64_t source_value,
+				    int64_t timestamp)
 {
-	int ret;
-	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
-	struct lwis_client_event_state *event_state;
 	struct lwis_single_event_info *event;
-	struct list_head *p;
-	uint64_t source_value, reset_value = 0;
-	struct lwis_client *lwis_client;
-	struct list_head *t, *n;
+	DECLARE_BITMAP(pending, LWIS_INTERRUPT_MAX_REG_BITS);
+	unsigned int bit;
+	uint64_t reset_value;
+	uint64_t storm_value;
+	struct lwis_irq_storm_event_payload storm_payload;
 #ifdef LWIS_INTERRUPT_DEBUG
 	uint64_t mask_value;
 #endif
 	unsigned long flags;
 
-	/* Read the mask register */
-	ret = lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid, irq->irq_src_reg,
-					       &source_value, irq->irq_reg_access_size);
-	if (ret) {
-		dev_err(irq->lwis_dev->dev, "%s: Failed to read IRQ status register: %d\n",
-			irq->name, ret);
-		goto error;
-	}
-
-	/* Write back to the reset register */
-	ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid, irq->irq_reset_reg,
-						source_value, irq->irq_reg_access_size);
-	if (ret) {
-		dev_err(irq->lwis_dev->dev, "%s: Failed to write IRQ reset register: %d\n",
-			irq->name, ret);
-		goto error;
+	spin_lock_irqsave(&irq->lock, flags);
+	storm_value = storm_check_locked(irq, source_value, timestamp);
+	if (storm_value) {
+		/* Mask the storming bits until lwis_interrupt_storm_work releases them */
+		lwis_interrupt_set_mask_bits(irq, storm_value, irq->mask_toggled,
+					     /*flush_now=*/true);
+		bit = __ffs64(storm_value);
+		storm_payload.int_reg_bits = storm_value;
+		storm_payload.event_id = irq->enabled_events_by_bit[bit] ?
+						 irq->enabled_events_by_bit[bit]->event_id :
+						 0;
+		storm_payload.threshold = irq->storm_threshold;
+		storm_payload.window_ms = div_s64(irq->storm_window_ns, NSEC_PER_MSEC);
+		storm_payload.cooldown_ms = div_s64(irq->storm_cooldown_ns, NSEC_PER_MSEC);
 	}
+	/* Only visit the bits that are both set and have an enabled event, and
+	 * clear them. Enable-once bits were already masked by the hard IRQ
+	 * handler */
+	reset_value = source_value & irq->enabled_bits;
+	spin_unlock_irqrestore(&irq->lock, flags);
 
-	/* Nothing is triggered, just return */
-	if (source_value == 0) {
-		return IRQ_HANDLED;
+	if (storm_value) {
+		dev_err_ratelimited(irq->lwis_dev->dev,
+				    "%s: Interrupt storm, masking bits 0x%llx for %u ms\n", irq->name,
+				    storm_value, storm_payload.cooldown_ms);
+		lwis_device_error_event_emit(irq->lwis_dev, LWIS_ERROR_EVENT_ID_IRQ_STORM,
+					     &storm_payload, sizeof(storm_payload));
+		schedule_delayed_work(&irq->storm_work, nsecs_to_jiffies(irq->storm_cooldown_ns));
 	}
 
-	spin_lock_irqsave(&irq->lock, flags);
-	list_for_each (p, &irq->enabled_event_infos) {
-		event = list_entry(p, struct lwis_single_event_info, node_enabled);
-
-		/* Check if this event needs to be emitted */
-		if ((source_value >> event->int_reg_bit) & 0x1) {
-			/* Emit the event */
-			lwis_device_event_emit(irq->lwis_dev, event->event_id, NULL, 0,
-					       /*in_irq=*/true);
-			/* Clear this interrupt */
-			reset_value |= (1ULL << event->int_reg_bit);
+	bitmap_from_u64(pending, reset_value);
+	rcu_read_lock();
+	for_each_set_bit (bit, pending, LWIS_INTERRUPT_MAX_REG_BITS) {
+		for (event = rcu_dereference(irq->enabled_events_by_bit[bit]); event != NULL;
+		     event = rcu_dereference(event->next_enabled_same_bit)) {
+			/* Emit the event, stamped with the time the interrupt was taken */
+			lwis_device_event_emit_timestamped(irq->lwis_dev, event->event_id, NULL, 0,
+							   timestamp, /*in_irq=*/true);
 
 			/* If considered critical, print the event */
 			if (event->is_critical) {
@@ -271,31 +380,13 @@ static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
 						    "Caught critical IRQ(%s) event(0x%llx)\n",
 						    irq->name, event->event_id);
 			}
-			/* If enabled once, set interrupt mask to false */
-			list_for_each_safe (t, n, &irq->lwis_dev->clients) {
-				lwis_client = list_entry(t, struct lwis_client, node);
-				hash_for_each_possible (lwis_client->event_states, event_state,
-							node, event->event_id) {
-					if (event_state->event_control.event_id ==
-						    event->event_id &&
-					    event_state->event_control.flags &
-						    LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE) {
-						dev_err(irq->lwis_dev->dev,
-							"IRQ(%s) event(0x%llx) enabled once\n",
-							irq->name, event->event_id);
-						lwis_interrupt_set_mask(irq, event->int_reg_bit,
-									false);
-					}
-				}
+			if (READ_ONCE(event->enable_once)) {
+				dev_err(irq->lwis_dev->dev, "IRQ(%s) event(0x%llx) enabled once\n",
+					irq->name, event->event_id);
 			}
 		}
-
-		/* All enabled and triggered interrupts are handled */
-		if (source_value == reset_value) {
-			break;
-		}
 	}
-	spin_unlock_irqrestore(&irq->lock, flags);
+	rcu_read_unlock();
 
 #ifdef LWIS_INTERRUPT_DEBUG
 	/* Make sure the number of interrupts triggered matches the number of
@@ -319,25 +410,205 @@ static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
 		}
 	}
 #endif
-error:
+}
+
+/* Unmasks the bits whose storm cool-down has passed */
+static void lwis_interrupt_storm_work(struct work_struct *work)
+{
+	struct lwis_interrupt *irq =
+		container_of(to_delayed_work(work), struct lwis_interrupt, storm_work);
+	DECLARE_BITMAP(throttled, LWIS_INTERRUPT_MAX_REG_BITS);
+	struct lwis_interrupt_bit_stats *stats;
+	unsigned int bit;
+	uint64_t release_value = 0;
+	int64_t now = ktime_to_ns(lwis_get_time());
+	int64_t next_release_ns = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&irq->lock, flags);
+	bitmap_from_u64(throttled, irq->throttled_bits);
+	for_each_set_bit (bit, throttled, LWIS_INTERRUPT_MAX_REG_BITS) {
+		stats = &irq->bit_stats[bit];
+		if (stats->throttled_until_ns <= now) {
+			release_value |= (1ULL << bit);
+			stats->window_start_ns = now;
+			stats->window_count = 0;
+		} else if (next_release_ns == 0 || stats->throttled_until_ns < next_release_ns) {
+			next_release_ns = stats->throttled_until_ns;
+		}
+	}
+	irq->throttled_bits &= ~release_value;
+	/* Bits with no enabled event, or masked after firing once, stay masked */
+	release_value &= irq->enabled_bits & ~irq->once_bits;
+	if (release_value) {
+		lwis_interrupt_set_mask_bits(irq, release_value, !irq->mask_toggled,
+					     /*flush_now=*/true);
+	}
+	spin_unlock_irqrestore(&irq->lock, flags);
+
+	if (next_release_ns) {
+		schedule_delayed_work(&irq->storm_work, nsecs_to_jiffies(next_release_ns - now));
+	}
+}
+
+/*
+ * Latches a status for the IRQ thread. The status is already acked, so when
+ * the kfifo is full it is merged into irq->overflow_status rather than lost.
+ */
+static irqreturn_t lwis_interrupt_latch(struct lwis_interrupt *irq, uint64_t status)
+{
+	struct lwis_interrupt_latch latch = {
+		.status = status,
+		.timestamp = ktime_to_ns(lwis_get_time()),
+	};
+	unsigned long flags;
+
+	spin_lock_irqsave(&irq->lock, flags);
+	if (irq->overflow_status == 0 && kfifo_put(&irq->latched, latch)) {
+		spin_unlock_irqrestore(&irq->lock, flags);
+		return IRQ_WAKE_THREAD;
+	}
+	if (irq->overflow_status == 0) {
+		irq->overflow_timestamp = latch.timestamp;
+	}
+	irq->overflow_status |= status;
+	irq->latch_overflows++;
+	spin_unlock_irqrestore(&irq->lock, flags);
+
+	dev_warn_ratelimited(irq->lwis_dev->dev,
+			     "%s: IRQ thread fell behind, merged status 0x%llx\n", irq->name,
+			     status);
+	return IRQ_WAKE_THREAD;
+}
+
+/*
+ * Takes the next latched status for the IRQ thread: the kfifo first, then the
+ * statuses merged after it overflowed. Returns false once both are empty.
+ */
+static bool lwis_interrupt_latch_get(struct lwis_interrupt *irq,
+				     struct lwis_interrupt_latch *latch)
+{
+	unsigned long flags;
+	bool found = false;
+
+	if (kfifo_get(&irq->latched, latch)) {
+		return true;
+	}
+
+	spin_lock_irqsave(&irq->lock, flags);
+	if (irq->overflow_status != 0) {
+		latch->status = irq->overflow_status;
+		latch->timestamp = irq->overflow_timestamp;
+		irq->overflow_status = 0;
+		found = true;
+	}
+	spin_unlock_irqrestore(&irq->lock, flags);
+	return found;
+}
+
+/*
+ * Masks the enable-once bits of status as soon as they fire, and drops the
+ * ones that already fired from it, so each emits its event only once.
+ */
+static uint64_t once_bits_mask(struct lwis_interrupt *irq, uint64_t status)
+{
+	uint64_t once_value;
+	unsigned long flags;
+
+	spin_lock_irqsave(&irq->lock, flags);
+	status &= ~irq->once_fired_bits;
+	once_value = status & irq->once_bits & irq->enabled_bits;
+	if (once_value) {
+		lwis_interrupt_set_mask_bits(irq, once_value, false, /*flush_now=*/true);
+		irq->once_fired_bits |= once_value;
+	}
+	spin_unlock_irqrestore(&irq->lock, flags);
+	return status;
+}
+
+/*
+ * Hard IRQ handler: only reads and acks the status register and latches the
+ * result with a timestamp. Event fan-out is left to the IRQ thread.
+ */
+static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
+{
+	int ret;
+	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
+	uint64_t source_value;
+
+	/* Read the mask register */
+	ret = lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid, irq->irq_src_reg,
+					       &source_value, irq->irq_reg_access_size);
+	if (ret) {
+		dev_err(irq->lwis_dev->dev, "%s: Failed to read IRQ status register: %d\n",
+			irq->name, ret);
+		return IRQ_HANDLED;
+	}
+
+	/* Write back to the reset register */
+	ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid, irq->irq_reset_reg,
+						source_value, irq->irq_reg_access_size);
+	if (ret) {
+		dev_err(irq->lwis_dev->dev, "%s: Failed to write IRQ reset register: %d\n",
+			irq->name, ret);
+		return IRQ_HANDLED;
+	}
+
+	/* Mask enable-once bits in the pass that sees them, as one register update */
+	source_value = once_bits_mask(irq, source_value);
+
+	/* Nothing is triggered, just return */
+	if (source_value == 0) {
+		return IRQ_HANDLED;
+	}
+
+	return lwis_interrupt_latch(irq, source_value);
+}
+
+static irqreturn_t lwis_interrupt_event_thread(int irq_number, void *data)
+{
+	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
+	struct lwis_interrupt_latch latch;
+
+	while (lwis_interrupt_latch_get(irq, &latch)) {
+		lwis_interrupt_dispatch(irq, latch.status, latch.timestamp);
+	}
 	return IRQ_HANDLED;
 }
 
 static irqreturn_t lwis_interrupt_gpios_event_isr(int irq_number, void *data)
+{
+	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
+
+	return lwis_interrupt_latch(irq, /*status=*/1);
+}
+
+static irqreturn_t lwis_interrupt_gpios_event_thread(int irq_number, void *data)
 {
 	unsigned long flags;
 	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
 	struct lwis_single_event_info *event;
-	struct list_head *p;
+	struct lwis_interrupt_latch latch;
+	int64_t event_id;
 
-	spin_lock_irqsave(&irq->lock, flags);
-	list_for_each (p, &irq->enabled_event_infos) {
-		event = list_entry(p, struct lwis_single_event_info, node_enabled);
-		/* Emit the event */
-		lwis_device_event_emit(irq->lwis_dev, event->event_id, NULL, 0, /*in_irq=*/true);
-	}
-	spin_unlock_irqrestore(&irq->lock, flags);
+	while (lwis_interrupt_latch_get(irq, &latch)) {
+		/* GPIO interrupts carry a single event, see
+		   lwis_interrupt_set_gpios_event_info */
+		event_id = 0;
+		spin_lock_irqsave(&irq->lock, flags);
+		event = list_first_entry_or_null(&irq->enabled_event_infos,
+						 struct lwis_single_event_info, node_enabled);
+		if (event) {
+			event_id = event->event_id;
+		}
+		spin_unlock_irqrestore(&irq->lock, flags);
 
+		if (event_id) {
+			/* Emit the event */
+			lwis_device_event_emit_timestamped(irq->lwis_dev, event_id, NULL, 0,
+							   latch.timestamp, /*in_irq=*/true);
+		}
+	}
 	return IRQ_HANDLED;
 }
 
@@ -357,6 +628,12 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 		pr_err("reg bits num != irq event num.\n");
 		return -EINVAL;
 	}
+	for (i = 0; i < int_reg_bits_num; i++) {
+		if (int_reg_bits[i] >= LWIS_INTERRUPT_MAX_REG_BITS) {
+			pr_err("Invalid int-reg-bit %u\n", int_reg_bits[i]);
+			return -EINVAL;
+		}
+	}
 
 	/* Protect the structure */
 	spin_lock_irqsave(&list->irq[index].lock, flags);
@@ -371,6 +648,13 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 	hash_init(list->irq[index].event_infos);
 	/* Initialize an empty list for enabled events */
 	INIT_LIST_HEAD(&list->irq[index].enabled_event_infos);
+	memset(list->irq[index].enabled_events_by_bit, 0,
+	       sizeof(list->irq[index].enabled_events_by_bit));
+	list->irq[index].enabled_bits = 0;
+	list->irq[index].once_bits = 0;
+	list->irq[index].once_fired_bits = 0;
+	list->irq[index].mask_shadow_valid = false;
+	list->irq[index].mask_dirty = false;
 	spin_unlock_irqrestore(&list->irq[index].lock, flags);
 
 	/* Build the hash table of events we can emit */
@@ -437,6 +721,13 @@ int lwis_interrupt_set_gpios_event_info(struct lwis_interrupt_list *list, int in
 	hash_init(list->irq[index].event_infos);
 	/* Initialize an empty list for enabled events */
 	INIT_LIST_HEAD(&list->irq[index].enabled_event_infos);
+	memset(list->irq[index].enabled_events_by_bit, 0,
+	       sizeof(list->irq[index].enabled_events_by_bit));
+	list->irq[index].enabled_bits = 0;
+	list->irq[index].once_bits = 0;
+	list->irq[index].once_fired_bits = 0;
+	list->irq[index].mask_shadow_valid = false;
+	list->irq[index].mask_dirty = false;
 	spin_unlock_irqrestore(&list->irq[index].lock, flags);
 
 	/* Build the hash table of events we can emit */
@@ -478,6 +769,38 @@ int lwis_interrupt_set_gpios_event_info(struct lwis_interrupt_list *list, int in
 	return 0;
 }
 
+/* Appends event to the chain of its bit, keeping the order events were enabled in */
+static void enabled_by_bit_add(struct lwis_interrupt *irq, struct lwis_single_event_info *event)
+{
+	struct lwis_single_event_info **pp = &irq->enabled_events_by_bit[event->int_reg_bit];
+
+	while (*pp != NULL) {
+		pp = &(*pp)->next_enabled_same_bit;
+	}
+	/* A reader may still be on the event if it was just disabled */
+	WRITE_ONCE(event->next_enabled_same_bit, NULL);
+	/* Publish the event only once its own link is terminated */
+	rcu_assign_pointer(*pp, event);
+	irq->enabled_bits |= (1ULL << event->int_reg_bit);
+}
+
+static void enabled_by_bit_remove(struct lwis_interrupt *irq, struct lwis_single_event_info *event)
+{
+	struct lwis_single_event_info **pp = &irq->enabled_events_by_bit[event->int_reg_bit];
+
+	while (*pp != NULL && *pp != event) {
+		pp = &(*pp)->next_enabled_same_bit;
+	}
+	/* The link of the removed event is kept for readers still on it, it is
+	 * reset when the event is enabled again */
+	if (*pp == event) {
+		rcu_assign_pointer(*pp, event->next_enabled_same_bit);
+	}
+	if (irq->enabled_events_by_bit[event->int_reg_bit] == NULL) {
+		irq->enabled_bits &= ~(1ULL << event->int_reg_bit);
+	}
+}
+
 static int lwis_interrupt_single_event_enable_locked(struct lwis_interrupt *irq,
 						     struct lwis_single_event_info *event,
 						     bool enabled)
@@ -497,8 +820,14 @@ static int lwis_interrupt_single_event_enable_locked(struct lwis_interrupt *irq,
 
 	if (enabled) {
 		list_add_tail(&event->node_enabled, &irq->enabled_event_infos);
+		enabled_by_bit_add(irq, event);
+		/* An enable-once event may fire once more */
+		irq->once_fired_bits &= ~(1ULL << event->int_reg_bit);
+		/* An explicit enable overrides storm throttling */
+		irq->throttled_bits &= ~(1ULL << event->int_reg_bit);
 	} else {
 		list_del(&event->node_enabled);
+		enabled_by_bit_remove(irq, event);
 	}
 
 	/* If mask_toggled is set, reverse the enable/disable logic. */
@@ -508,6 +837,81 @@ static int lwis_interrupt_single_event_enable_locked(struct lwis_interrupt *irq,
 	return ret;
 }
 
+int lwis_interrupt_set_storm_limits(struct lwis_interrupt_list *list, int index,
+				    uint32_t threshold, uint32_t window_ms, uint32_t cooldown_ms)
+{
+	unsigned long flags;
+
+	if (!list || index < 0 || index >= list->count) {
+		return -EINVAL;
+	}
+
+	if (window_ms == 0) {
+		window_ms = LWIS_INTERRUPT_STORM_DEFAULT_WINDOW_MS;
+	}
+	if (cooldown_ms == 0) {
+		cooldown_ms = LWIS_INTERRUPT_STORM_DEFAULT_COOLDOWN_MS;
+	}
+
+	spin_lock_irqsave(&list->irq[index].lock, flags);
+	list->irq[index].storm_threshold = threshold;
+	list->irq[index].storm_window_ns = (int64_t)window_ms * NSEC_PER_MSEC;
+	list->irq[index].storm_cooldown_ns = (int64_t)cooldown_ms * NSEC_PER_MSEC;
+	spin_unlock_irqrestore(&list->irq[index].lock, flags);
+
+	return 0;
+}
+
+int lwis_interrupt_set_affinity(struct lwis_interrupt_list *list, int index, uint64_t cpu_mask)
+{
+	struct lwis_interrupt *irq;
+	cpumask_var_t cpus;
+	unsigned long flags;
+	int ret;
+
+	if (!list || index < 0 || index >= list->count) {
+		return -EINVAL;
+	}
+	irq = &list->irq[index];
+
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+		return -ENOMEM;
+	}
+	lwis_cpumask_from_u64(cpus, cpu_mask);
+	if (!cpumask_intersects(cpus, cpu_online_mask)) {
+		free_cpumask_var(cpus);
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&irq->lock, flags);
+	cpumask_copy(&irq->affinity, cpus);
+	ret = irq_set_affinity_hint(irq->irq, &irq->affinity);
+	spin_unlock_irqrestore(&irq->lock, flags);
+	free_cpumask_var(cpus);
+
+	if (ret) {
+		dev_err(irq->lwis_dev->dev, "Failed to set %s affinity to 0x%llx (%d)\n", irq->name,
+			cpu_mask, ret);
+	}
+	return ret;
+}
+
+int lwis_interrupt_get_affinity(struct lwis_interrupt_list *list, int index, uint64_t *cpu_mask)
+{
+	const struct cpumask *effective;
+
+	if (!list || index < 0 || index >= list->count) {
+		return -EINVAL;
+	}
+
+	effective = irq_get_effective_affinity_mask(list->irq[index].irq);
+	if (!effective) {
+		return -EINVAL;
+	}
+	*cpu_mask = lwis_cpumask_to_u64(effective);
+	return 0;
+}
+
 int lwis_interrupt_event_enable(struct lwis_interrupt_list *list, int64_t event_id, bool enabled)
 {
 	int index, ret = -EINVAL;
@@ -531,6 +935,130 @@ int lwis_interrupt_event_enable(struct lwis_interrupt_list *list, int64_t event_
 	return ret;
 }
 
+/* Recomputes the enable-once state of a bit from all the events on it */
+static void update_once_bit_locked(struct lwis_interrupt *irq, int int_reg_bit)
+{
+	struct lwis_single_event_info *p;
+	int bkt;
+
+	irq->once_bits &= ~(1ULL << int_reg_bit);
+	hash_for_each (irq->event_infos, bkt, p, node) {
+		if (p->int_reg_bit == int_reg_bit && p->enable_once) {
+			irq->once_bits |= (1ULL << int_reg_bit);
+			return;
+		}
+	}
+}
+
+void lwis_interrupt_event_set_enable_once(struct lwis_interrupt_list *list, int64_t event_id,
+					  bool enable_once)
+{
+	int index;
+	unsigned long flags;
+	struct lwis_single_event_info *event;
+
+	if (!list) {
+		return;
+	}
+
+	for (index = 0; index < list->count; index++) {
+		spin_lock_irqsave(&list->irq[index].lock, flags);
+		event = lwis_interrupt_get_single_event_info_locked(&list->irq[index], event_id);
+		if (event) {
+			event->enable_once = enable_once;
+			update_once_bit_locked(&list->irq[index], event->int_reg_bit);
+		}
+		spin_unlock_irqrestore(&list->irq[index].lock, flags);
+	}
+}
+
+void lwis_interrupt_mask_batch_begin(struct lwis_interrupt_list *list)
+{
+	if (!list) {
+		return;
+	}
+	atomic_inc(&list->mask_batch_depth);
+}
+
+int lwis_interrupt_mask_batch_end(struct lwis_interrupt_list *list)
+{
+	int index, ret, last_error = 0;
+	unsigned long flags;
+
+	if (!list) {
+		return 0;
+	}
+	if (!atomic_dec_and_test(&list->mask_batch_depth)) {
+		return 0;
+	}
+
+	for (index = 0; index < list->count; index++) {
+		spin_lock_irqsave(&list->irq[index].lock, flags);
+		if (list->irq[index].mask_dirty) {
+			ret = mask_flush_locked(&list->irq[index]);
+			if (ret) {
+				last_error = ret;
+			}
+		}
+		spin_unlock_irqrestore(&list->irq[index].lock, flags);
+	}
+	return last_error;
+}
+
+void lwis_interrupt_mask_shadow_invalidate(struct lwis_interrupt_list *list)
+{
+	int index;
+	unsigned long flags;
+
+	if (!list) {
+		return;
+	}
+
+	for (index = 0; index < list->count; index++) {
+		cancel_delayed_work_sync(&list->irq[index].storm_work);
+		spin_lock_irqsave(&list->irq[index].lock, flags);
+		list->irq[index].mask_shadow_valid = false;
+		list->irq[index].mask_dirty = false;
+		list->irq[index].throttled_bits = 0;
+		spin_unlock_irqrestore(&list->irq[index].lock, flags);
+	}
+}
+
+void lwis_interrupt_storm_info(struct lwis_interrupt_list *list, char *buffer, size_t buffer_size)
+{
+	struct lwis_interrupt *irq;
+	struct lwis_interrupt_bit_stats *stats;
+	int index, bit;
+	size_t len = 0;
+	unsigned long flags;
+
+	if (!list) {
+		scnprintf(buffer, buffer_size, "No interrupts\n");
+		return;
+	}
+
+	for (index = 0; index < list->count; index++) {
+		irq = &list->irq[index];
+		spin_lock_irqsave(&irq->lock, flags);
+		len += scnprintf(buffer + len, buffer_size - len,
+				 "%s: threshold %u per %lld ms, cool-down %lld ms, throttled 0x%llx\n",
+				 irq->name, irq->storm_threshold,
+				 div_s64(irq->storm_window_ns, NSEC_PER_MSEC),
+				 div_s64(irq->storm_cooldown_ns, NSEC_PER_MSEC), irq->throttled_bits);
+		for (bit = 0; bit < LWIS_INTERRUPT_MAX_REG_BITS; bit++) {
+			stats = &irq->bit_stats[bit];
+			if (stats->total_count == 0) {
+				continue;
+			}
+			len += scnprintf(buffer + len, buffer_size - len,
+					 "  bit %d: total %llu, in window %u, throttled %u times\n",
+					 bit, stats->total_count, stats->window_count,
+					 stats->throttle_count);
+		}
+		spin_unlock_irqrestore(&irq->lock, flags);
+	}
+}
+
 void lwis_interrupt_print(struct lwis_interrupt_list *list)
 {
 	int i;
@@ -11,13 +11,44 @@
 #ifndef LWIS_INTERRUPT_H_
 #define LWIS_INTERRUPT_H_
 
+#include <linux/cpumask.h>
 #include <linux/hashtable.h>
 #include <linux/interrupt.h>
+#include <linux/kfifo.h>
 #include <linux/list.h>
 #include <linux/platform_device.h>
+#include <linux/workqueue.h>
 
 #define EVENT_INFO_HASH_BITS 8
 #define IRQ_FULL_NAME_LENGTH 32
+/* Number of bits in the status/reset/mask registers */
+#define LWIS_INTERRUPT_MAX_REG_BITS 64
+/* Interrupts the hard IRQ handler can latch before the IRQ thread runs, power of 2 */
+#define LWIS_INTERRUPT_LATCH_DEPTH 16
+
+/* Default interrupt storm window and cool-down, when only a threshold is set */
+#define LWIS_INTERRUPT_STORM_DEFAULT_WINDOW_MS 10
+#define LWIS_INTERRUPT_STORM_DEFAULT_COOLDOWN_MS 100
+
+/* Status read and acked by the hard IRQ handler, dispatched by the IRQ thread */
+struct lwis_interrupt_latch {
+	uint64_t status;
+	int64_t timestamp;
+};
+
+/* Rate tracking of one status bit, for interrupt storm detection */
+struct lwis_interrupt_bit_stats {
+	/* Times the bit was seen set since probe */
+	uint64_t total_count;
+	/* Times the bit was seen set in the current window */
+	uint32_t window_count;
+	/* Start of the current window */
+	int64_t window_start_ns;
+	/* Times the bit was masked for exceeding the threshold */
+	uint32_t throttle_count;
+	/* While throttled, when the bit may be unmasked again */
+	int64_t throttled_until_ns;
+};
 
 struct lwis_interrupt {
 	int irq;
@@ -51,6 +82,57 @@ struct lwis_interrupt {
 	/* List of enabled events */
 	/* GUARDED_BY(lock) */
 	struct list_head enabled_event_infos;
+	/* Enabled events indexed by status bit, chained when several share a bit.
+	 * Updated under lock, walked under RCU by the IRQ thread */
+	/* GUARDED_BY(lock) */
+	struct lwis_single_event_info *enabled_events_by_bit[LWIS_INTERRUPT_MAX_REG_BITS];
+	/* Status bits with at least one enabled event */
+	/* GUARDED_BY(lock) */
+	uint64_t enabled_bits;
+	/* Status bits to mask once they fire, for IRQ_ENABLE_ONCE events */
+	/* GUARDED_BY(lock) */
+	uint64_t once_bits;
+	/* Enable-once bits that fired and were masked by the hard IRQ handler,
+	 * until their event is enabled again */
+	/* GUARDED_BY(lock) */
+	uint64_t once_fired_bits;
+	/* Copy of the mask register, read from hardware on first use after
+	 * power-up */
+	/* GUARDED_BY(lock) */
+	uint64_t mask_shadow;
+	/* GUARDED_BY(lock) */
+	bool mask_shadow_valid;
+	/* The shadow holds changes not yet written to the mask register */
+	/* GUARDED_BY(lock) */
+	bool mask_dirty;
+	/* Times a bit may fire within storm_window_ns before it is masked,
+	 * 0 disables storm detection */
+	uint32_t storm_threshold;
+	int64_t storm_window_ns;
+	/* How long a bit stays masked after a storm */
+	int64_t storm_cooldown_ns;
+	/* GUARDED_BY(lock) */
+	struct lwis_interrupt_bit_stats bit_stats[LWIS_INTERRUPT_MAX_REG_BITS];
+	/* Bits currently masked because of an interrupt storm */
+	/* GUARDED_BY(lock) */
+	uint64_t throttled_bits;
+	/* Unmasks throttled bits once their cool-down has passed */
+	struct delayed_work storm_work;
+	/* CPUs requested for this interrupt, the IRQ core keeps a pointer to
+	 * it as the affinity hint */
+	struct cpumask affinity;
+	/* Single producer (hard IRQ handler), single consumer (IRQ thread) */
+	DECLARE_KFIFO(latched, struct lwis_interrupt_latch, LWIS_INTERRUPT_LATCH_DEPTH);
+	/* Statuses latched while the kfifo was full, merged into one, and the
+	 * time of the first of them. Once set, later statuses are merged too, so
+	 * the IRQ thread sees them after what is in the kfifo */
+	/* GUARDED_BY(lock) */
+	uint64_t overflow_status;
+	/* GUARDED_BY(lock) */
+	int64_t overflow_timestamp;
+	/* Latched interrupts merged because the IRQ thread fell behind */
+	/* GUARDED_BY(lock) */
+	unsigned int latch_overflows;
 };
 
 /*
@@ -62,6 +144,8 @@ struct lwis_interrupt_list {
 	int count;
 	/* Device that owns this interrupt list */
 	struct lwis_device *lwis_dev;
+	/* Mask register writes are deferred while this is non-zero */
+	atomic_t mask_batch_depth;
 };
 
 /*
@@ -115,6 +199,35 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 int lwis_interrupt_set_gpios_event_info(struct lwis_interrupt_list *list, int index,
 					int64_t irq_event);
 
+/*
+ * lwis_interrupt_set_storm_limits: Sets the interrupt storm budget for a given
+ * interrupt based on index. A status bit that fires more than threshold times
+ * within window_ms is masked for cooldown_ms and an
+ * LWIS_ERROR_EVENT_ID_IRQ_STORM error event is emitted. A threshold of 0
+ * disables storm detection, 0 window_ms or cooldown_ms select the defaults.
+ *
+ * Returns: 0 on success
+ */
+int lwis_interrupt_set_storm_limits(struct lwis_interrupt_list *list, int index,
+				    uint32_t threshold, uint32_t window_ms, uint32_t cooldown_ms);
+
+/*
+ * lwis_interrupt_set_affinity: Moves the interrupt at index, and with it its
+ * IRQ thread, to the CPUs in cpu_mask, one bit per CPU. Replaces the
+ * platform default set by lwis_interrupt_get.
+ *
+ * Returns: 0 on success
+ */
+int lwis_interrupt_set_affinity(struct lwis_interrupt_list *list, int index, uint64_t cpu_mask);
+
+/*
+ * lwis_interrupt_get_affinity: Returns the CPUs the interrupt at index is
+ * actually delivered to, one bit per CPU, in *cpu_mask.
+ *
+ * Returns: 0 on success
+ */
+int lwis_interrupt_get_affinity(struct lwis_interrupt_list *list, int index, uint64_t *cpu_mask);
+
 /*
  * lwis_interrupt_event_enable: Handles masking and unmasking interrupts when
  * an event is enabled or disabled
@@ -126,6 +239,48 @@ int lwis_interrupt_set_gpios_event_info(struct lwis_interrupt_list *list, int in
  */
 int lwis_interrupt_event_enable(struct lwis_interrupt_list *list, int64_t event_id, bool enabled);
 
+/*
+ * lwis_interrupt_mask_batch_begin: Defers mask register writes so that any
+ * number of event enables/disables cost one write per mask register, made by
+ * the matching lwis_interrupt_mask_batch_end. Batches may nest.
+ */
+void lwis_interrupt_mask_batch_begin(struct lwis_interrupt_list *list);
+
+/*
+ * lwis_interrupt_mask_batch_end: Ends a batch started with
+ * lwis_interrupt_mask_batch_begin, flushing the mask registers that changed
+ * once the outermost batch ends.
+ *
+ * Returns: 0 on success, or the last mask register write error
+ */
+int lwis_interrupt_mask_batch_end(struct lwis_interrupt_list *list);
+
+/*
+ * lwis_interrupt_mask_shadow_invalidate: Forgets the mask register shadows,
+ * called when the device powers up or down and register contents may have
+ * been reset. The next mask update reads the register again. Bits throttled
+ * for an interrupt storm are released as well, their masking does not
+ * survive the reset.
+ */
+void lwis_interrupt_mask_shadow_invalidate(struct lwis_interrupt_list *list);
+
+/*
+ * lwis_interrupt_event_set_enable_once: Marks whether an event's interrupt
+ * bit is to be masked the first time it fires, i.e. whether any client set
+ * LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE on it.
+ *
+ * Locks: May lock list->irq[index].lock
+ * Alloc: No
+ */
+void lwis_interrupt_event_set_enable_once(struct lwis_interrupt_list *list, int64_t event_id,
+					  bool enable_once);
+
+/*
+ * lwis_interrupt_storm_info: Prints the per-bit interrupt counters and
+ * throttling state of every interrupt in the list into buffer, for debugfs.
+ */
+void lwis_interrupt_storm_info(struct lwis_interrupt_list *list, char *buffer, size_t buffer_size);
+
 /*
  *  lwis_interrupt_print: Debug function to print all the interrupts in the
  *  supplied list.
@@ -10,37 +10,151 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME "-ioentry: " fmt
 
+#include <linux/build_bug.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 
 #include "lwis_io_entry.h"
 #include "lwis_util.h"
 
-int lwis_io_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry, bool non_blocking)
+/* Poll interval used when an entry does not specify one */
+#define LWIS_IO_ENTRY_POLL_DEFAULT_INTERVAL_US 10
+/* Intervals up to this long are busy-waited, longer ones sleep */
+#define LWIS_IO_ENTRY_POLL_SPIN_MAX_US 10
+/* Cap for the backed-off poll interval, the previous fixed interval */
+#define LWIS_IO_ENTRY_POLL_MAX_INTERVAL_US 1000
+/* Longest a poll may spin with IRQs disabled */
+#define LWIS_IO_ENTRY_POLL_ATOMIC_MAX_US 100
+
+/* Returns 0 on a match, 1 on a mismatch and the read error otherwise */
+static int read_and_compare(struct lwis_device *lwis_dev, int bid, uint64_t offset,
+			    uint64_t expected, uint64_t mask)
 {
-	uint64_t val, start;
-	uint64_t timeout_ms = entry->read_assert.timeout_ms;
-	int ret = 0;
+	uint64_t val;
+	int ret;
 
-	/* Only read and check once if non_blocking */
-	if (non_blocking) {
-		timeout_ms = 0;
+	ret = lwis_device_single_register_read(lwis_dev, bid, offset, &val,
+					       lwis_dev->native_value_bitwidth);
+	if (ret) {
+		return ret;
+	}
+	return ((val & mask) == (expected & mask)) ? 0 : 1;
+}
+
+/*
+ * Spins without sleeping, like readx_poll_timeout_atomic(), for at most
+ * LWIS_IO_ENTRY_POLL_ATOMIC_MAX_US so an IRQ-context transaction still gets a
+ * short handshake window.
+ */
+static int poll_atomic(struct lwis_device *lwis_dev, int bid, uint64_t offset, uint64_t expected,
+		       uint64_t mask, uint64_t timeout_us, uint32_t interval_us)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	if (timeout_us > LWIS_IO_ENTRY_POLL_ATOMIC_MAX_US) {
+		dev_warn_ratelimited(lwis_dev->dev,
+				     "Poll timeout %lluus capped to %dus in atomic context\n",
+				     timeout_us, LWIS_IO_ENTRY_POLL_ATOMIC_MAX_US);
+		timeout_us = LWIS_IO_ENTRY_POLL_ATOMIC_MAX_US;
 	}
+	interval_us = min_t(uint32_t, interval_us, LWIS_IO_ENTRY_POLL_SPIN_MAX_US);
+	for (;;) {
+		ret = read_and_compare(lwis_dev, bid, offset, expected, mask);
+		if (ret <= 0) {
+			return ret;
+		}
+		if ((uint64_t)ktime_us_delta(ktime_get(), start) > timeout_us) {
+			break;
+		}
+		if (interval_us) {
+			udelay(interval_us);
+		} else {
+			cpu_relax();
+		}
+	}
+	/* Check one last time, we may have been held up after the last read */
+	return read_and_compare(lwis_dev, bid, offset, expected, mask);
+}
 
-	/* Read until getting the expected value or timeout */
-	val = ~entry->read_assert.val;
-	start = ktime_to_ms(lwis_get_time());
-	while (val != entry->read_assert.val) {
-		ret = lwis_io_entry_read_assert(lwis_dev, entry);
-		if (ret == 0) {
+/*
+ * Busy-waits for short intervals and sleeps for longer ones, doubling the
+ * interval after each miss up to LWIS_IO_ENTRY_POLL_MAX_INTERVAL_US.
+ */
+static int poll_sleep(struct lwis_device *lwis_dev, int bid, uint64_t offset, uint64_t expected,
+		      uint64_t mask, uint64_t timeout_us, uint32_t interval_us)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	if (interval_us == 0) {
+		interval_us = LWIS_IO_ENTRY_POLL_DEFAULT_INTERVAL_US;
+	}
+	for (;;) {
+		ret = read_and_compare(lwis_dev, bid, offset, expected, mask);
+		if (ret <= 0) {
+			return ret;
+		}
+		if ((uint64_t)ktime_us_delta(ktime_get(), start) > timeout_us) {
 			break;
 		}
-		if (ktime_to_ms(lwis_get_time()) - start > timeout_ms) {
-			dev_err(lwis_dev->dev, "Polling timed out: block %d offset 0x%llx\n",
-				entry->read_assert.bid, entry->read_assert.offset);
-			return -ETIMEDOUT;
+		if (interval_us <= LWIS_IO_ENTRY_POLL_SPIN_MAX_US) {
+			udelay(interval_us);
+		} else {
+			usleep_range(interval_us, interval_us + interval_us / 4);
 		}
-		/* Sleep for 1ms */
-		usleep_range(1000, 1000);
+		/* Only back off below the cap, so doubling can't overflow */
+		if (interval_us < LWIS_IO_ENTRY_POLL_MAX_INTERVAL_US) {
+			interval_us = min_t(uint32_t, interval_us * 2,
+					    LWIS_IO_ENTRY_POLL_MAX_INTERVAL_US);
+		}
+	}
+	return read_and_compare(lwis_dev, bid, offset, expected, mask);
+}
+
+int lwis_io_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry, bool non_blocking)
+{
+	int bid;
+	uint64_t offset, val, mask, timeout_us;
+	uint32_t interval_us = 0;
+	int ret;
+
+	/* poll_us must not grow the entry, userspace arrays rely on its stride */
+	BUILD_BUG_ON(sizeof(struct lwis_io_entry_poll_us) >
+		     sizeof(struct lwis_io_entry_read_assert));
+	BUILD_BUG_ON(sizeof(struct lwis_io_entry) !=
+		     offsetof(struct lwis_io_entry, read_assert) +
+			     sizeof(struct lwis_io_entry_read_assert));
+
+	if (entry->type == LWIS_IO_ENTRY_POLL_US) {
+		bid = entry->poll_us.bid;
+		offset = entry->poll_us.offset;
+		val = entry->poll_us.val;
+		mask = entry->poll_us.mask;
+		timeout_us = entry->poll_us.timeout_us;
+		interval_us = entry->poll_us.interval_us;
+	} else {
+		bid = entry->read_assert.bid;
+		offset = entry->read_assert.offset;
+		val = entry->read_assert.val;
+		mask = entry->read_assert.mask;
+		timeout_us = (entry->read_assert.timeout_ms > U64_MAX / USEC_PER_MSEC) ?
+				     U64_MAX :
+					   entry->read_assert.timeout_ms * USEC_PER_MSEC;
+	}
+
+	if (non_blocking) {
+		ret = poll_atomic(lwis_dev, bid, offset, val, mask, timeout_us, interval_us);
+	} else {
+		ret = poll_sleep(lwis_dev, bid, offset, val, mask, timeout_us, interval_us);
+	}
+	if (ret > 0) {
+		dev_err(lwis_dev->dev, "Polling timed out: block %d offset 0x%llx\n", bid, offset);
+		return -ETIMEDOUT;
+	}
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to read registers: block %d offset 0x%llx\n", bid,
+			offset);
 	}
 	return ret;
 }
@@ -63,3 +177,49 @@ int lwis_io_entry_read_assert(struct lwis_device *lwis_dev, struct lwis_io_entry
 	}
 	return -EINVAL;
 }
+
+static bool is_write_type(struct lwis_io_entry *entry)
+{
+	return entry->type == LWIS_IO_ENTRY_WRITE || entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
+	       entry->type == LWIS_IO_ENTRY_MODIFY;
+}
+
+int lwis_io_entry_write_run(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+			    int num_entries, bool non_blocking, int *run_length)
+{
+	int i = 0;
+	int num_written = 0;
+	int ret;
+
+	*run_length = 0;
+	if (lwis_dev->vops.register_io_multi != NULL) {
+		while (i < num_entries && is_write_type(&entries[i])) {
+			i++;
+		}
+		if (i < 2) {
+			return 0;
+		}
+		return lwis_dev->vops.register_io_multi(lwis_dev, entries, i,
+							lwis_dev->native_value_bitwidth,
+							run_length);
+	}
+
+	if (lwis_dev->vops.register_io_multi_write == NULL || non_blocking) {
+		return 0;
+	}
+
+	while (i < num_entries && entries[i].type == LWIS_IO_ENTRY_WRITE) {
+		i++;
+	}
+	/* A single write gains nothing from batching */
+	if (i < 2) {
+		return 0;
+	}
+
+	ret = lwis_dev->vops.register_io_multi_write(lwis_dev, entries, i,
+						     lwis_dev->native_value_bitwidth, &num_written);
+	/* On failure, count the entries that reached the device and the one
+	   taken as failed, so they are not written again */
+	*run_length = ret ? num_written + 1 : i;
+	return ret;
+}
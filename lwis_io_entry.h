@@ -17,6 +17,8 @@
 /*
  * lwis_io_entry_poll:
  * Polls a register for a specified time or until it reaches the expected value.
+ * Handles both LWIS_IO_ENTRY_POLL and LWIS_IO_ENTRY_POLL_US. With non_blocking
+ * the poll spins without sleeping for a bounded time, for use in IRQ context.
  */
 int lwis_io_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 		       bool non_blocking);
@@ -27,4 +29,19 @@ int lwis_io_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry
  */
 int lwis_io_entry_read_assert(struct lwis_device *lwis_dev, struct lwis_io_entry *entry);
 
+/*
+ * lwis_io_entry_write_run:
+ * Processes the run of write entries at the start of entries in one call to
+ * the device: register_io_multi for runs of WRITE, WRITE_BATCH and MODIFY
+ * entries, or else register_io_multi_write for runs of WRITE entries, which
+ * may sleep and is skipped when non_blocking. *run_length is set to the number
+ * of entries processed, or to 0 if there is nothing to batch and the first
+ * entry should go through register_io. On error it counts the entries known
+ * to have been written plus the one taken as failed, or may be 0 if nothing
+ * was tried. For I2C multi writes the failed entry is the first of the failed
+ * transfer, whose later messages may or may not have landed.
+ */
+int lwis_io_entry_write_run(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+			    int num_entries, bool non_blocking, int *run_length);
+
 #endif /* LWIS_IO_ENTRY_H_ */
\ No newline at end of file
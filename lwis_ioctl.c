@@ -12,8 +12,10 @@
 
 #include "lwis_ioctl.h"
 
+#include <linux/capability.h>
 #include <linux/kernel.h>
 #include <linux/mm.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 
@@ -89,6 +91,22 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_RESET), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_RESET);
 		break;
+	case IOCTL_TO_ENUM(LWIS_ALLOCATOR_RESERVE):
+		strlcpy(type_name, STRINGIFY(LWIS_ALLOCATOR_RESERVE), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_ALLOCATOR_RESERVE);
+		break;
+	case IOCTL_TO_ENUM(LWIS_CPU_AFFINITY):
+		strlcpy(type_name, STRINGIFY(LWIS_CPU_AFFINITY), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_CPU_AFFINITY);
+		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_ENROLL_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_ENROLL_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_ENROLL_BATCH);
+		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_DISENROLL_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_DISENROLL_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_DISENROLL_BATCH);
+		break;
 	case IOCTL_TO_ENUM(LWIS_EVENT_CONTROL_GET):
 		strlcpy(type_name, STRINGIFY(LWIS_EVENT_CONTROL_GET), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_CONTROL_GET);
@@ -141,6 +159,10 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 		strlcpy(type_name, STRINGIFY(LWIS_PERIODIC_IO_CANCEL), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_PERIODIC_IO_CANCEL);
 		break;
+	case IOCTL_TO_ENUM(LWIS_PERIODIC_IO_SUBMIT_ANCHORED):
+		strlcpy(type_name, STRINGIFY(LWIS_PERIODIC_IO_SUBMIT_ANCHORED), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_PERIODIC_IO_SUBMIT_ANCHORED);
+		break;
 	default:
 		strlcpy(type_name, "UNDEFINED", sizeof(type_name));
 		exp_size = 0;
@@ -390,6 +412,7 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 					  struct lwis_io_entry *user_msg)
 {
 	int ret = 0, i = 0;
+	int run_length, run_end;
 
 	/* Use write memory barrier at the beginning of I/O entries if the access protocol
 	 * allows it */
@@ -399,6 +422,27 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 						   /*use_write_barrier=*/true);
 	}
 	for (i = 0; i < num_io_entries; i++) {
+		if (io_entries[i].type == LWIS_IO_ENTRY_WRITE ||
+		    io_entries[i].type == LWIS_IO_ENTRY_MODIFY) {
+			/* Batch buffers still point to userspace here, so end the run
+			 * at the first WRITE_BATCH */
+			run_end = i + 1;
+			while (run_end < num_io_entries &&
+			       io_entries[run_end].type != LWIS_IO_ENTRY_WRITE_BATCH) {
+				run_end++;
+			}
+			/* Let the device write the whole run of writes at once */
+			ret = lwis_io_entry_write_run(lwis_dev, &io_entries[i], run_end - i,
+						      /*non_blocking=*/false, &run_length);
+			if (ret) {
+				dev_err(lwis_dev->dev, "Register io_entry failed\n");
+				goto exit;
+			}
+			if (run_length > 0) {
+				i += run_length - 1;
+				continue;
+			}
+		}
 		switch (io_entries[i].type) {
 		case LWIS_IO_ENTRY_MODIFY:
 			ret = register_modify(lwis_dev, &io_entries[i]);
@@ -412,6 +456,7 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 			ret = register_write(lwis_dev, &io_entries[i]);
 			break;
 		case LWIS_IO_ENTRY_POLL:
+		case LWIS_IO_ENTRY_POLL_US:
 			ret = lwis_io_entry_poll(lwis_dev, &io_entries[i], /*non_blocking=*/false);
 			break;
 		case LWIS_IO_ENTRY_READ_ASSERT:
@@ -563,7 +608,7 @@ static int ioctl_buffer_enroll(struct lwis_client *lwis_client, struct lwis_buff
 	if (copy_to_user((void __user *)msg, (void *)&buffer->info, sizeof(buffer->info))) {
 		ret = -EFAULT;
 		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(buffer->info));
-		lwis_buffer_disenroll(lwis_client, buffer);
+		lwis_buffer_enroll_revert(lwis_client, buffer);
 		goto error_enroll;
 	}
 
@@ -612,6 +657,151 @@ static int ioctl_buffer_disenroll(struct lwis_client *lwis_client,
 	return 0;
 }
 
+/*
+ * Enrolls every buffer in the batch under a single hold of the client lock.
+ * Per-buffer failures are reported in each entry's result; an error is only
+ * returned if the batch itself could not be processed, in which case no
+ * buffer is left enrolled.
+ */
+static int ioctl_buffer_enroll_batch(struct lwis_client *lwis_client,
+				     struct lwis_buffer_enroll_batch __user *msg)
+{
+	struct lwis_buffer_enroll_batch k_msg;
+	struct lwis_buffer_enroll_entry *k_entries;
+	struct lwis_enrolled_buffer *buffer;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	int ret = 0;
+	int i;
+	size_t buf_size;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg,
+			   sizeof(struct lwis_buffer_enroll_batch))) {
+		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
+		return -EFAULT;
+	}
+
+	if (k_msg.num_entries > LWIS_BUFFER_BATCH_MAX_ENTRIES) {
+		dev_err(lwis_dev->dev, "Too many enroll entries %zu, at most %d\n",
+			k_msg.num_entries, LWIS_BUFFER_BATCH_MAX_ENTRIES);
+		return -EINVAL;
+	}
+	buf_size = sizeof(struct lwis_buffer_enroll_entry) * k_msg.num_entries;
+	k_entries = kmalloc(buf_size, GFP_KERNEL);
+	if (!k_entries) {
+		dev_err(lwis_dev->dev, "Failed to allocate enroll entries\n");
+		return -ENOMEM;
+	}
+	if (copy_from_user(k_entries, (void __user *)k_msg.entries, buf_size)) {
+		ret = -EFAULT;
+		dev_err(lwis_dev->dev, "Failed to copy enroll entries from user\n");
+		goto out;
+	}
+
+	for (i = 0; i < k_msg.num_entries; i++) {
+		buffer = kmalloc(sizeof(struct lwis_enrolled_buffer), GFP_KERNEL);
+		if (!buffer) {
+			dev_err(lwis_dev->dev, "Failed to allocate lwis_enrolled_buffer struct\n");
+			k_entries[i].result = -ENOMEM;
+			continue;
+		}
+		buffer->info = k_entries[i].info;
+		k_entries[i].result = lwis_buffer_enroll(lwis_client, buffer);
+		if (k_entries[i].result) {
+			dev_err(lwis_dev->dev, "Failed to enroll buffer for fd %d\n",
+				k_entries[i].info.fd);
+			kfree(buffer);
+			continue;
+		}
+		k_entries[i].info = buffer->info;
+	}
+
+	if (copy_to_user((void __user *)k_msg.entries, k_entries, buf_size)) {
+		ret = -EFAULT;
+		dev_err(lwis_dev->dev, "Failed to copy enroll entries to user\n");
+		/* Userspace won't know the addresses, so roll back the whole batch */
+		for (i = 0; i < k_msg.num_entries; i++) {
+			if (k_entries[i].result) {
+				continue;
+			}
+			buffer = lwis_client_enrolled_buffer_find(lwis_client, k_entries[i].info.fd,
+								  k_entries[i].info.dma_vaddr);
+			if (buffer) {
+				lwis_buffer_enroll_revert(lwis_client, buffer);
+				kfree(buffer);
+			}
+		}
+	}
+out:
+	kfree(k_entries);
+	return ret;
+}
+
+/*
+ * Disenrolls every buffer in the batch under a single hold of the client lock.
+ * Per-buffer failures are reported in each entry's result.
+ */
+static int ioctl_buffer_disenroll_batch(struct lwis_client *lwis_client,
+					struct lwis_buffer_disenroll_batch __user *msg)
+{
+	struct lwis_buffer_disenroll_batch k_msg;
+	struct lwis_buffer_disenroll_entry *k_entries;
+	struct lwis_enrolled_buffer *buffer;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	int ret = 0;
+	int i;
+	size_t buf_size;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg,
+			   sizeof(struct lwis_buffer_disenroll_batch))) {
+		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
+		return -EFAULT;
+	}
+
+	if (k_msg.num_entries > LWIS_BUFFER_BATCH_MAX_ENTRIES) {
+		dev_err(lwis_dev->dev, "Too many disenroll entries %zu, at most %d\n",
+			k_msg.num_entries, LWIS_BUFFER_BATCH_MAX_ENTRIES);
+		return -EINVAL;
+	}
+	buf_size = sizeof(struct lwis_buffer_disenroll_entry) * k_msg.num_entries;
+	k_entries = kmalloc(buf_size, GFP_KERNEL);
+	if (!k_entries) {
+		dev_err(lwis_dev->dev, "Failed to allocate disenroll entries\n");
+		return -ENOMEM;
+	}
+	if (copy_from_user(k_entries, (void __user *)k_msg.entries, buf_size)) {
+		ret = -EFAULT;
+		dev_err(lwis_dev->dev, "Failed to copy disenroll entries from user\n");
+		goto out;
+	}
+
+	for (i = 0; i < k_msg.num_entries; i++) {
+		buffer = lwis_client_enrolled_buffer_find(lwis_client, k_entries[i].info.fd,
+							  k_entries[i].info.dma_vaddr);
+		if (!buffer) {
+			dev_err(lwis_dev->dev, "Failed to find dma buffer for fd %d vaddr %pad\n",
+				k_entries[i].info.fd, &k_entries[i].info.dma_vaddr);
+			k_entries[i].result = -ENOENT;
+			continue;
+		}
+		k_entries[i].result = lwis_buffer_disenroll(lwis_client, buffer);
+		if (k_entries[i].result) {
+			dev_err(lwis_dev->dev,
+				"Failed to disenroll dma buffer for fd %d vaddr %pad\n",
+				k_entries[i].info.fd, &k_entries[i].info.dma_vaddr);
+			continue;
+		}
+		kfree(buffer);
+	}
+
+	if (copy_to_user((void __user *)k_msg.entries, k_entries, buf_size)) {
+		ret = -EFAULT;
+		dev_err(lwis_dev->dev, "Failed to copy disenroll entries to user\n");
+	}
+out:
+	kfree(k_entries);
+	return ret;
+}
+
 static int ioctl_buffer_cpu_access(struct lwis_client *lwis_client,
 				   struct lwis_buffer_cpu_access_op __user *msg)
 {
@@ -887,19 +1077,145 @@ static int ioctl_event_control_set(struct lwis_client *lwis_client,
 		goto out;
 	}
 
+	/* Apply all the controls, then write each changed IRQ mask register once */
+	lwis_interrupt_mask_batch_begin(lwis_dev->irqs);
 	for (i = 0; i < k_msg.num_event_controls; i++) {
 		ret = lwis_client_event_control_set(lwis_client, &k_event_controls[i]);
 		if (ret) {
 			dev_err(lwis_dev->dev, "Failed to apply event control 0x%llx\n",
 				k_event_controls[i].event_id);
-			goto out;
+			break;
 		}
 	}
+	if (lwis_interrupt_mask_batch_end(lwis_dev->irqs) && !ret) {
+		dev_err(lwis_dev->dev, "Failed to update IRQ masks\n");
+		ret = -EIO;
+	}
 out:
 	kfree(k_event_controls);
 	return ret;
 }
 
+static int ioctl_allocator_reserve(struct lwis_client *lwis_client,
+				   struct lwis_allocator_reserve_info __user *msg)
+{
+	struct lwis_allocator_reserve_info k_msg;
+	struct lwis_allocator_reserve_entry *k_entries;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	int ret = 0;
+	int i;
+	size_t buf_size;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg,
+			   sizeof(struct lwis_allocator_reserve_info))) {
+		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
+		return -EFAULT;
+	}
+
+	if (k_msg.num_entries > LWIS_ALLOCATOR_MAX_RESERVE_ENTRIES) {
+		dev_err(lwis_dev->dev, "Too many reserve entries %zu, at most %d\n",
+			k_msg.num_entries, LWIS_ALLOCATOR_MAX_RESERVE_ENTRIES);
+		return -EINVAL;
+	}
+	buf_size = sizeof(struct lwis_allocator_reserve_entry) * k_msg.num_entries;
+	k_entries = kmalloc(buf_size, GFP_KERNEL);
+	if (!k_entries) {
+		dev_err(lwis_dev->dev, "Failed to allocate reserve entries\n");
+		return -ENOMEM;
+	}
+	if (copy_from_user(k_entries, (void __user *)k_msg.entries, buf_size)) {
+		ret = -EFAULT;
+		dev_err(lwis_dev->dev, "Failed to copy reserve entries from user\n");
+		goto out;
+	}
+
+	for (i = 0; i < k_msg.num_entries; i++) {
+		ret = lwis_allocator_reserve(lwis_client, k_entries[i].size,
+					     k_entries[i].num_blocks);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to reserve %u blocks of %zu bytes\n",
+				k_entries[i].num_blocks, k_entries[i].size);
+			goto out;
+		}
+	}
+out:
+	kfree(k_entries);
+	return ret;
+}
+
+static int ioctl_cpu_affinity(struct lwis_device *lwis_dev, struct lwis_cpu_affinity __user *msg)
+{
+	struct lwis_cpu_affinity k_affinity;
+	struct task_struct *task = NULL;
+	int ret = 0;
+
+	if (copy_from_user((void *)&k_affinity, (void __user *)msg, sizeof(k_affinity))) {
+		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
+		return -EFAULT;
+	}
+
+	/* Anyone with the device open may query, but moving interrupts and threads
+	 * can disturb the rest of the system, so it takes the same privilege as
+	 * sched_setaffinity on another user's task */
+	if (k_affinity.cpu_mask != 0 && !capable(CAP_SYS_NICE)) {
+		dev_err_ratelimited(lwis_dev->dev, "Setting CPU affinity needs CAP_SYS_NICE\n");
+		return -EPERM;
+	}
+
+	switch (k_affinity.target) {
+	case LWIS_CPU_AFFINITY_IRQ:
+		if (k_affinity.cpu_mask != 0) {
+			ret = lwis_interrupt_set_affinity(lwis_dev->irqs, k_affinity.index,
+							  k_affinity.cpu_mask);
+			if (ret) {
+				return ret;
+			}
+		}
+		ret = lwis_interrupt_get_affinity(lwis_dev->irqs, k_affinity.index,
+						  &k_affinity.effective_cpu_mask);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to get affinity of interrupt %d\n",
+				k_affinity.index);
+			return ret;
+		}
+		k_affinity.last_cpu = -1;
+		break;
+	case LWIS_CPU_AFFINITY_TRANSACTION_WORKER:
+		task = lwis_dev->transaction_worker_thread;
+		break;
+	case LWIS_CPU_AFFINITY_PERIODIC_IO_WORKER:
+		task = lwis_dev->periodic_io_worker_thread;
+		break;
+	case LWIS_CPU_AFFINITY_SUBSCRIBE_WORKER:
+		task = lwis_dev->subscribe_worker_thread;
+		break;
+	default:
+		dev_err(lwis_dev->dev, "Unknown CPU affinity target %d\n", k_affinity.target);
+		return -EINVAL;
+	}
+
+	if (k_affinity.target != LWIS_CPU_AFFINITY_IRQ) {
+		if (IS_ERR_OR_NULL(task)) {
+			return -ENODEV;
+		}
+		if (k_affinity.cpu_mask != 0) {
+			ret = lwis_set_kthread_affinity(lwis_dev, task, k_affinity.cpu_mask);
+			if (ret) {
+				return ret;
+			}
+		}
+		k_affinity.effective_cpu_mask = lwis_cpumask_to_u64(task->cpus_ptr);
+		k_affinity.last_cpu = task_cpu(task);
+	}
+
+	if (copy_to_user((void __user *)msg, &k_affinity, sizeof(k_affinity))) {
+		dev_err(lwis_dev->dev, "Failed to copy CPU affinity to userspace\n");
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 static int ioctl_event_dequeue(struct lwis_client *lwis_client, struct lwis_event_info __user *msg)
 {
 	unsigned long ret = 0;
@@ -1249,6 +1565,8 @@ static int construct_periodic_io(struct lwis_client *client,
 
 	k_periodic_io->resp = NULL;
 	k_periodic_io->periodic_io_list = NULL;
+	k_periodic_io->trigger_event_id = LWIS_EVENT_ID_NONE;
+	k_periodic_io->trigger_offset_ns = 0;
 
 	*periodic_io = k_periodic_io;
 	return 0;
@@ -1258,8 +1576,8 @@ error_free_periodic_io:
 	return ret;
 }
 
-static int ioctl_periodic_io_submit(struct lwis_client *client,
-				    struct lwis_periodic_io_info __user *msg)
+static int periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io_info __user *msg,
+			      int64_t trigger_event_id, int64_t trigger_offset_ns)
 {
 	int ret = 0;
 	struct lwis_periodic_io *k_periodic_io = NULL;
@@ -1269,6 +1587,8 @@ static int ioctl_periodic_io_submit(struct lwis_client *client,
 	if (ret) {
 		return ret;
 	}
+	k_periodic_io->trigger_event_id = trigger_event_id;
+	k_periodic_io->trigger_offset_ns = trigger_offset_ns;
 
 	ret = lwis_periodic_io_submit(client, k_periodic_io);
 	if (ret) {
@@ -1291,6 +1611,28 @@ static int ioctl_periodic_io_submit(struct lwis_client *client,
 	return ret;
 }
 
+static int ioctl_periodic_io_submit(struct lwis_client *client,
+				    struct lwis_periodic_io_info __user *msg)
+{
+	return periodic_io_submit(client, msg, LWIS_EVENT_ID_NONE, 0);
+}
+
+static int ioctl_periodic_io_submit_anchored(struct lwis_client *client,
+					     struct lwis_periodic_io_anchored_info __user *msg)
+{
+	int64_t trigger_event_id;
+	int64_t trigger_offset_ns;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (get_user(trigger_event_id, &msg->trigger_event_id) ||
+	    get_user(trigger_offset_ns, &msg->trigger_offset_ns)) {
+		dev_err(lwis_dev->dev, "Failed to copy periodic io trigger from user\n");
+		return -EFAULT;
+	}
+
+	return periodic_io_submit(client, &msg->info, trigger_event_id, trigger_offset_ns);
+}
+
 static int ioctl_periodic_io_cancel(struct lwis_client *client, int64_t __user *msg)
 {
 	int ret = 0;
@@ -1461,7 +1803,9 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 	    type != LWIS_EVENT_CONTROL_GET && type != LWIS_TIME_QUERY &&
 	    type != LWIS_EVENT_DEQUEUE && type != LWIS_BUFFER_ENROLL &&
 	    type != LWIS_BUFFER_DISENROLL && type != LWIS_BUFFER_FREE &&
-	    type != LWIS_DPM_QOS_UPDATE && type != LWIS_DPM_GET_CLOCK) {
+	    type != LWIS_DPM_QOS_UPDATE && type != LWIS_DPM_GET_CLOCK &&
+	    type != LWIS_ALLOCATOR_RESERVE && type != LWIS_CPU_AFFINITY &&
+	    type != LWIS_BUFFER_ENROLL_BATCH && type != LWIS_BUFFER_DISENROLL_BATCH) {
 		ret = -EBADFD;
 		dev_err_ratelimited(lwis_dev->dev, "Unsupported IOCTL on disabled device.\n");
 		goto out;
@@ -1509,6 +1853,14 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 		ret = ioctl_buffer_disenroll(lwis_client,
 					     (struct lwis_enrolled_buffer_info *)param);
 		break;
+	case LWIS_BUFFER_ENROLL_BATCH:
+		ret = ioctl_buffer_enroll_batch(lwis_client,
+						(struct lwis_buffer_enroll_batch *)param);
+		break;
+	case LWIS_BUFFER_DISENROLL_BATCH:
+		ret = ioctl_buffer_disenroll_batch(lwis_client,
+						   (struct lwis_buffer_disenroll_batch *)param);
+		break;
 	case LWIS_BUFFER_CPU_ACCESS:
 		ret = ioctl_buffer_cpu_access(lwis_client,
 					      (struct lwis_buffer_cpu_access_op *)param);
@@ -1528,6 +1880,13 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 	case LWIS_DEVICE_RESET:
 		ret = ioctl_device_reset(lwis_client, (struct lwis_io_entries *)param);
 		break;
+	case LWIS_ALLOCATOR_RESERVE:
+		ret = ioctl_allocator_reserve(lwis_client,
+					      (struct lwis_allocator_reserve_info *)param);
+		break;
+	case LWIS_CPU_AFFINITY:
+		ret = ioctl_cpu_affinity(lwis_dev, (struct lwis_cpu_affinity *)param);
+		break;
 	case LWIS_EVENT_CONTROL_GET:
 		ret = ioctl_event_control_get(lwis_client, (struct lwis_event_control *)param);
 		break;
@@ -1555,6 +1914,10 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 	case LWIS_PERIODIC_IO_CANCEL:
 		ret = ioctl_periodic_io_cancel(lwis_client, (int64_t *)param);
 		break;
+	case LWIS_PERIODIC_IO_SUBMIT_ANCHORED:
+		ret = ioctl_periodic_io_submit_anchored(
+			lwis_client, (struct lwis_periodic_io_anchored_info *)param);
+		break;
 	case LWIS_DPM_CLK_UPDATE:
 		ret = ioctl_dpm_clk_update(lwis_dev, (struct lwis_dpm_clk_settings *)param);
 		break;
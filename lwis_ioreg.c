@@ -13,11 +13,29 @@
 #include <linux/bitops.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 
 #include "lwis_device.h"
 #include "lwis_ioreg.h"
 
+/* Register accesses made per acquisition of the device lock by lwis_ioreg_io_entries_rw,
+   bounds the time spent with IRQs disabled */
+#define LWIS_IOREG_MAX_ACCESSES_PER_LOCK 256
+
+/* Number of register bytes a batch entry touches, a FIFO is a single register */
+static size_t batch_span_bytes(struct lwis_ioreg_device *ioreg_dev,
+			       struct lwis_io_entry_rw_batch *rw_batch)
+{
+	if (rw_batch->is_offset_fixed) {
+		return ioreg_dev->base_dev.native_value_bitwidth / 8;
+	}
+	return rw_batch->size_in_bytes;
+}
+
 static int find_block_idx_by_name(struct lwis_ioreg_list *list, char *name)
 {
 	int i;
@@ -214,10 +232,47 @@ int lwis_ioreg_put_by_name(struct lwis_ioreg_device *ioreg_dev, char *name)
 	return 0;
 }
 
+/*
+ * Copy registers of an auto-incrementing range from/to buf, four registers per
+ * iteration. addr is a uint8_t pointer to the first register.
+ */
+#define IOREG_READ_UNROLLED(read_fn, type, addr, buf, size_in_bytes)                          \
+	do {                                                                                   \
+		size_t i = 0;                                                                  \
+		for (; i + 4 * sizeof(type) <= (size_in_bytes); i += 4 * sizeof(type)) {       \
+			*(type *)((buf) + i) = read_fn((void __iomem *)((addr) + i));          \
+			*(type *)((buf) + i + sizeof(type)) =                                  \
+				read_fn((void __iomem *)((addr) + i + sizeof(type)));          \
+			*(type *)((buf) + i + 2 * sizeof(type)) =                              \
+				read_fn((void __iomem *)((addr) + i + 2 * sizeof(type)));      \
+			*(type *)((buf) + i + 3 * sizeof(type)) =                              \
+				read_fn((void __iomem *)((addr) + i + 3 * sizeof(type)));      \
+		}                                                                              \
+		for (; i < (size_in_bytes); i += sizeof(type)) {                               \
+			*(type *)((buf) + i) = read_fn((void __iomem *)((addr) + i));          \
+		}                                                                              \
+	} while (0)
+
+#define IOREG_WRITE_UNROLLED(write_fn, type, addr, buf, size_in_bytes)                        \
+	do {                                                                                   \
+		size_t i = 0;                                                                  \
+		for (; i + 4 * sizeof(type) <= (size_in_bytes); i += 4 * sizeof(type)) {       \
+			write_fn(*(type *)((buf) + i), (void __iomem *)((addr) + i));          \
+			write_fn(*(type *)((buf) + i + sizeof(type)),                          \
+				 (void __iomem *)((addr) + i + sizeof(type)));                 \
+			write_fn(*(type *)((buf) + i + 2 * sizeof(type)),                      \
+				 (void __iomem *)((addr) + i + 2 * sizeof(type)));             \
+			write_fn(*(type *)((buf) + i + 3 * sizeof(type)),                      \
+				 (void __iomem *)((addr) + i + 3 * sizeof(type)));             \
+		}                                                                              \
+		for (; i < (size_in_bytes); i += sizeof(type)) {                               \
+			write_fn(*(type *)((buf) + i), (void __iomem *)((addr) + i));          \
+		}                                                                              \
+	} while (0)
+
 static int ioreg_read_batch_internal(void __iomem *base, uint64_t offset, int value_bits,
-				     size_t size_in_bytes, uint8_t *buf)
+				     size_t size_in_bytes, uint8_t *buf, bool is_offset_fixed)
 {
-	int i;
 	uint8_t *addr = (uint8_t *)base + offset;
 
 	if (size_in_bytes & (value_bits / 8) - 1) {
@@ -226,26 +281,39 @@ static int ioreg_read_batch_internal(void __iomem *base, uint64_t offset, int va
 		return -EINVAL;
 	}
 
+	/* Drain a hardware FIFO sitting behind a single register */
+	if (is_offset_fixed) {
+		switch (value_bits) {
+		case 8:
+			ioread8_rep((void __iomem *)addr, buf, size_in_bytes);
+			break;
+		case 16:
+			ioread16_rep((void __iomem *)addr, buf, size_in_bytes / 2);
+			break;
+		case 32:
+			ioread32_rep((void __iomem *)addr, buf, size_in_bytes / 4);
+			break;
+		case 64:
+			readsq((void __iomem *)addr, buf, size_in_bytes / 8);
+			break;
+		default:
+			return -EINVAL;
+		}
+		return 0;
+	}
+
 	switch (value_bits) {
 	case 8:
-		for (i = 0; i < size_in_bytes; ++i) {
-			*(buf + i) = readb_relaxed((void __iomem *)(addr + i));
-		}
+		IOREG_READ_UNROLLED(readb_relaxed, uint8_t, addr, buf, size_in_bytes);
 		break;
 	case 16:
-		for (i = 0; i < size_in_bytes; i += 2) {
-			*(uint16_t *)(buf + i) = readw_relaxed((void __iomem *)(addr + i));
-		}
+		IOREG_READ_UNROLLED(readw_relaxed, uint16_t, addr, buf, size_in_bytes);
 		break;
 	case 32:
-		for (i = 0; i < size_in_bytes; i += 4) {
-			*(uint32_t *)(buf + i) = readl_relaxed((void __iomem *)(addr + i));
-		}
+		IOREG_READ_UNROLLED(readl_relaxed, uint32_t, addr, buf, size_in_bytes);
 		break;
 	case 64:
-		for (i = 0; i < size_in_bytes; i += 8) {
-			*(uint64_t *)(buf + i) = readq_relaxed((void __iomem *)(addr + i));
-		}
+		IOREG_READ_UNROLLED(readq_relaxed, uint64_t, addr, buf, size_in_bytes);
 		break;
 	default:
 		return -EINVAL;
@@ -257,7 +325,6 @@ static int ioreg_read_batch_internal(void __iomem *base, uint64_t offset, int va
 static int ioreg_write_batch_internal(void __iomem *base, uint64_t offset, int value_bits,
 				      size_t size_in_bytes, uint8_t *buf, bool is_offset_fixed)
 {
-	int i;
 	uint8_t *addr = (uint8_t *)base + offset;
 
 	if (size_in_bytes & (value_bits / 8) - 1) {
@@ -266,33 +333,39 @@ static int ioreg_write_batch_internal(void __iomem *base, uint64_t offset, int v
 		return -EINVAL;
 	}
 
+	/* Fill a hardware FIFO sitting behind a single register */
+	if (is_offset_fixed) {
+		switch (value_bits) {
+		case 8:
+			iowrite8_rep((void __iomem *)addr, buf, size_in_bytes);
+			break;
+		case 16:
+			iowrite16_rep((void __iomem *)addr, buf, size_in_bytes / 2);
+			break;
+		case 32:
+			iowrite32_rep((void __iomem *)addr, buf, size_in_bytes / 4);
+			break;
+		case 64:
+			writesq((void __iomem *)addr, buf, size_in_bytes / 8);
+			break;
+		default:
+			return -EINVAL;
+		}
+		return 0;
+	}
+
 	switch (value_bits) {
 	case 8:
-		for (i = 0; i < size_in_bytes; ++i) {
-			writeb_relaxed(*(buf + i), is_offset_fixed ? (void __iomem *)(addr) :
-									   (void __iomem *)(addr + i));
-		}
+		IOREG_WRITE_UNROLLED(writeb_relaxed, uint8_t, addr, buf, size_in_bytes);
 		break;
 	case 16:
-		for (i = 0; i < size_in_bytes; i += 2) {
-			writew_relaxed(*(uint16_t *)(buf + i), is_offset_fixed ?
-								       (void __iomem *)(addr) :
-									     (void __iomem *)(addr + i));
-		}
+		IOREG_WRITE_UNROLLED(writew_relaxed, uint16_t, addr, buf, size_in_bytes);
 		break;
 	case 32:
-		for (i = 0; i < size_in_bytes; i += 4) {
-			writel_relaxed(*(uint32_t *)(buf + i), is_offset_fixed ?
-								       (void __iomem *)(addr) :
-									     (void __iomem *)(addr + i));
-		}
+		IOREG_WRITE_UNROLLED(writel_relaxed, uint32_t, addr, buf, size_in_bytes);
 		break;
 	case 64:
-		for (i = 0; i < size_in_bytes; i += 8) {
-			writeq_relaxed(*(uint64_t *)(buf + i), is_offset_fixed ?
-								       (void __iomem *)(addr) :
-									     (void __iomem *)(addr + i));
-		}
+		IOREG_WRITE_UNROLLED(writeq_relaxed, uint64_t, addr, buf, size_in_bytes);
 		break;
 	default:
 		return -EINVAL;
@@ -385,7 +458,7 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 		}
 
 		ret = validate_offset(ioreg_dev, block, entry->rw_batch.offset,
-				      entry->rw_batch.size_in_bytes,
+				      batch_span_bytes(ioreg_dev, &entry->rw_batch),
 				      ioreg_dev->base_dev.native_addr_bitwidth / 8);
 		if (ret) {
 			dev_err(ioreg_dev->base_dev.dev,
@@ -397,7 +470,8 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 
 		ret = ioreg_read_batch_internal(block->base, entry->rw_batch.offset,
 						ioreg_dev->base_dev.native_value_bitwidth,
-						entry->rw_batch.size_in_bytes, entry->rw_batch.buf);
+						entry->rw_batch.size_in_bytes, entry->rw_batch.buf,
+						entry->rw_batch.is_offset_fixed);
 		if (ret) {
 			dev_err(ioreg_dev->base_dev.dev, "Invalid ioreg batch read at:\n");
 			dev_err(ioreg_dev->base_dev.dev, "Offset: 0x%llx, Base: %pK\n",
@@ -426,7 +500,7 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 		}
 
 		ret = validate_offset(ioreg_dev, block, entry->rw_batch.offset,
-				      entry->rw_batch.size_in_bytes,
+				      batch_span_bytes(ioreg_dev, &entry->rw_batch),
 				      ioreg_dev->base_dev.native_addr_bitwidth / 8);
 		if (ret) {
 			dev_err(ioreg_dev->base_dev.dev,
@@ -473,6 +547,161 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 	return ret;
 }
 
+static int ioreg_entry_bid(struct lwis_io_entry *entry)
+{
+	switch (entry->type) {
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+	case LWIS_IO_ENTRY_READ_BATCH:
+		return entry->rw_batch.bid;
+	case LWIS_IO_ENTRY_MODIFY:
+		return entry->mod.bid;
+	default:
+		return entry->rw.bid;
+	}
+}
+
+/*
+ * Returns the block an entry of a multi-entry run targets, or NULL if the entry
+ * is not a register write this run can handle or would fail validation. Does
+ * not log, the entry is then left to lwis_ioreg_io_entry_rw to report.
+ */
+static struct lwis_ioreg *ioreg_entry_prevalidate(struct lwis_ioreg_device *ioreg_dev,
+						  struct lwis_io_entry *entry, int access_size)
+{
+	struct lwis_ioreg *block;
+	uint64_t offset;
+	size_t size_in_bytes;
+	unsigned int alignment = ioreg_dev->base_dev.native_addr_bitwidth / 8;
+	unsigned int native_value_bitwidth = ioreg_dev->base_dev.native_value_bitwidth;
+
+	if (entry->type == LWIS_IO_ENTRY_WRITE || entry->type == LWIS_IO_ENTRY_MODIFY) {
+		if (access_size != native_value_bitwidth) {
+			return NULL;
+		}
+		offset = (entry->type == LWIS_IO_ENTRY_WRITE) ? entry->rw.offset :
+								entry->mod.offset;
+		size_in_bytes = access_size / 8;
+	} else if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+		offset = entry->rw_batch.offset;
+		size_in_bytes = batch_span_bytes(ioreg_dev, &entry->rw_batch);
+		if (entry->rw_batch.size_in_bytes & (native_value_bitwidth / 8 - 1)) {
+			return NULL;
+		}
+	} else {
+		return NULL;
+	}
+
+	block = get_block_by_idx(ioreg_dev, ioreg_entry_bid(entry));
+	if (IS_ERR_OR_NULL(block)) {
+		return NULL;
+	}
+	if (offset % alignment || offset > U64_MAX - size_in_bytes ||
+	    offset + size_in_bytes > block->size) {
+		return NULL;
+	}
+	return block;
+}
+
+/* Processes an entry that passed ioreg_entry_prevalidate, with the device lock held */
+static int ioreg_entry_write_locked(struct lwis_ioreg_device *ioreg_dev,
+				    struct lwis_io_entry *entry, struct lwis_ioreg *block)
+{
+	int ret;
+	uint64_t reg_value;
+	unsigned int native_value_bitwidth = ioreg_dev->base_dev.native_value_bitwidth;
+
+	switch (entry->type) {
+	case LWIS_IO_ENTRY_WRITE:
+		return ioreg_write_internal(block->base, entry->rw.offset, native_value_bitwidth,
+					    entry->rw.val);
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		return ioreg_write_batch_internal(block->base, entry->rw_batch.offset,
+						  native_value_bitwidth,
+						  entry->rw_batch.size_in_bytes, entry->rw_batch.buf,
+						  entry->rw_batch.is_offset_fixed);
+	case LWIS_IO_ENTRY_MODIFY:
+		ret = ioreg_read_internal(block->base, entry->mod.offset, native_value_bitwidth,
+					  &reg_value);
+		if (ret) {
+			return ret;
+		}
+		reg_value &= ~entry->mod.val_mask;
+		reg_value |= entry->mod.val_mask & entry->mod.val;
+		return ioreg_write_internal(block->base, entry->mod.offset, native_value_bitwidth,
+					    reg_value);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Number of register accesses an entry costs towards LWIS_IOREG_MAX_ACCESSES_PER_LOCK */
+static int ioreg_entry_cost(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entry)
+{
+	size_t num_regs;
+
+	if (entry->type != LWIS_IO_ENTRY_WRITE_BATCH) {
+		return 1;
+	}
+	num_regs = entry->rw_batch.size_in_bytes / (ioreg_dev->base_dev.native_value_bitwidth / 8);
+	return (int)min_t(size_t, max_t(size_t, num_regs, 1), LWIS_IOREG_MAX_ACCESSES_PER_LOCK);
+}
+
+int lwis_ioreg_io_entries_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entries,
+			     int num_entries, int access_size, int *num_processed)
+{
+	int ret = 0;
+	int i, start, cost;
+	int num_valid = 0;
+	struct lwis_ioreg *block;
+	unsigned long flags;
+
+	*num_processed = 0;
+	if (!ioreg_dev) {
+		pr_err("LWIS IOREG device is NULL\n");
+		return -ENODEV;
+	}
+	if (ioreg_dev->base_dev.is_read_only) {
+		return 0;
+	}
+
+	/* Validate the whole run before touching hardware so none of it has to be
+	   done with IRQs disabled */
+	while (num_valid < num_entries &&
+	       ioreg_entry_prevalidate(ioreg_dev, &entries[num_valid], access_size)) {
+		num_valid++;
+	}
+
+	i = 0;
+	while (i < num_valid) {
+		/* Hold the lock for a bounded number of accesses to cap IRQ-off time */
+		start = i;
+		cost = 0;
+		spin_lock_irqsave(&ioreg_dev->base_dev.lock, flags);
+		while (i < num_valid) {
+			cost += ioreg_entry_cost(ioreg_dev, &entries[i]);
+			if (i > start && cost > LWIS_IOREG_MAX_ACCESSES_PER_LOCK) {
+				break;
+			}
+			block = get_block_by_idx(ioreg_dev, ioreg_entry_bid(&entries[i]));
+			ret = ioreg_entry_write_locked(ioreg_dev, &entries[i], block);
+			if (ret) {
+				break;
+			}
+			i++;
+		}
+		spin_unlock_irqrestore(&ioreg_dev->base_dev.lock, flags);
+		if (ret) {
+			dev_err(ioreg_dev->base_dev.dev, "ioreg write of io_entry %d failed: %d\n", i,
+				ret);
+			break;
+		}
+	}
+
+	/* A failed entry counts as processed so it is not retried */
+	*num_processed = ret ? i + 1 : i;
+	return ret;
+}
+
 int lwis_ioreg_read(struct lwis_ioreg_device *ioreg_dev, int index, uint64_t offset,
 		    uint64_t *value, int access_size)
 {
@@ -590,3 +819,286 @@ int lwis_ioreg_set_io_barrier(struct lwis_ioreg_device *ioreg_dev, bool use_read
 	}
 	return 0;
 }
+
+/*
+ * Shared by all VMAs split or forked from a single mmap() call, so they can be
+ * revoked together.
+ */
+struct lwis_ioreg_mmap {
+	struct lwis_ioreg_device *ioreg_dev;
+	struct lwis_ioreg *block;
+	/* vm_pgoff of the original VMA, first page of the block */
+	unsigned long pgoff;
+	struct address_space *mapping;
+	int refcount;
+	struct list_head node;
+};
+
+static void ioreg_mmap_vm_open(struct vm_area_struct *vma)
+{
+	struct lwis_ioreg_mmap *map = vma->vm_private_data;
+
+	mutex_lock(&map->ioreg_dev->mmap_lock);
+	map->refcount++;
+	mutex_unlock(&map->ioreg_dev->mmap_lock);
+}
+
+static void ioreg_mmap_vm_close(struct vm_area_struct *vma)
+{
+	struct lwis_ioreg_mmap *map = vma->vm_private_data;
+	struct lwis_ioreg_device *ioreg_dev = map->ioreg_dev;
+
+	mutex_lock(&ioreg_dev->mmap_lock);
+	if (--map->refcount == 0) {
+		list_del(&map->node);
+		kfree(map);
+	}
+	mutex_unlock(&ioreg_dev->mmap_lock);
+}
+
+static vm_fault_t ioreg_mmap_vm_fault(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct lwis_ioreg_mmap *map = vma->vm_private_data;
+	struct lwis_ioreg_device *ioreg_dev = map->ioreg_dev;
+	unsigned long pfn;
+	vm_fault_t ret;
+
+	mutex_lock(&ioreg_dev->mmap_lock);
+	/* Registers of a powered down block must not be touched */
+	if (!ioreg_dev->mmap_active) {
+		mutex_unlock(&ioreg_dev->mmap_lock);
+		return VM_FAULT_SIGBUS;
+	}
+	pfn = PHYS_PFN(map->block->start) + (vmf->pgoff - map->pgoff);
+	ret = vmf_insert_pfn(vma, vmf->address, pfn);
+	mutex_unlock(&ioreg_dev->mmap_lock);
+
+	return ret;
+}
+
+static const struct vm_operations_struct ioreg_mmap_vm_ops = {
+	.open = ioreg_mmap_vm_open,
+	.close = ioreg_mmap_vm_close,
+	.fault = ioreg_mmap_vm_fault,
+};
+
+int lwis_ioreg_mmap(struct lwis_ioreg_device *ioreg_dev, struct file *fp,
+		    struct vm_area_struct *vma)
+{
+	struct lwis_ioreg *block;
+	struct lwis_ioreg_mmap *map;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int ret = 0;
+
+	/* The page offset of the mapping selects the register block */
+	block = get_block_by_idx(ioreg_dev, vma->vm_pgoff);
+	if (IS_ERR_OR_NULL(block)) {
+		dev_err(ioreg_dev->base_dev.dev, "Invalid block index for mmap: %lu\n",
+			vma->vm_pgoff);
+		return -EINVAL;
+	}
+	if (!block->mmap_allowed) {
+		dev_err(ioreg_dev->base_dev.dev, "Block %s is not allowed to be mapped\n",
+			block->name);
+		return -EPERM;
+	}
+	/* A block that does not cover whole pages shares them with registers the
+	 * device tree did not allow, so it can't be mapped at all */
+	if (!PAGE_ALIGNED(block->start) || !PAGE_ALIGNED(block->size)) {
+		dev_err(ioreg_dev->base_dev.dev,
+			"Block %s at %pa (size %d) is not page aligned, cannot map it\n",
+			block->name, &block->start, block->size);
+		return -EINVAL;
+	}
+	if (size > block->size) {
+		dev_err(ioreg_dev->base_dev.dev,
+			"Cannot map %lu bytes of block %s (size %d)\n", size, block->name,
+			block->size);
+		return -EINVAL;
+	}
+	if (vma->vm_flags & VM_WRITE) {
+		dev_err(ioreg_dev->base_dev.dev, "Register blocks can only be mapped read-only\n");
+		return -EPERM;
+	}
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map) {
+		return -ENOMEM;
+	}
+	map->ioreg_dev = ioreg_dev;
+	map->block = block;
+	map->pgoff = vma->vm_pgoff;
+	map->mapping = fp->f_mapping;
+	map->refcount = 1;
+
+	mutex_lock(&ioreg_dev->mmap_lock);
+	if (!ioreg_dev->mmap_active) {
+		dev_err(ioreg_dev->base_dev.dev, "Device must be enabled to map registers\n");
+		ret = -EPERM;
+		goto error_unlock;
+	}
+	list_add(&map->node, &ioreg_dev->mmap_list);
+	mutex_unlock(&ioreg_dev->mmap_lock);
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_IO | VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP | VM_DONTCOPY;
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	vma->vm_private_data = map;
+	vma->vm_ops = &ioreg_mmap_vm_ops;
+
+	return 0;
+
+error_unlock:
+	mutex_unlock(&ioreg_dev->mmap_lock);
+	kfree(map);
+	return ret;
+}
+
+void lwis_ioreg_mmap_set_active(struct lwis_ioreg_device *ioreg_dev, bool active)
+{
+	struct lwis_ioreg_mmap *map;
+
+	mutex_lock(&ioreg_dev->mmap_lock);
+	ioreg_dev->mmap_active = active;
+	if (!active) {
+		/* Drop every PTE so the next access faults and gets SIGBUS */
+		list_for_each_entry (map, &ioreg_dev->mmap_list, node) {
+			unmap_mapping_range(map->mapping, 0, 0, 1);
+		}
+	}
+	mutex_unlock(&ioreg_dev->mmap_lock);
+}
+
+#ifdef CONFIG_DEBUG_FS
+/* Size of the table uploaded by lwis_ioreg_batch_benchmark */
+#define IOREG_BENCHMARK_TABLE_SIZE (256 * 1024)
+#define IOREG_BENCHMARK_ITERATIONS 16
+
+/* Register-at-a-time copy, used as the reference for the benchmark. A fixed
+   offset keeps hitting the first register, like a FIFO would. */
+static void ioreg_write_batch_reference(void __iomem *base, int value_bits, size_t size_in_bytes,
+					uint8_t *buf, bool is_offset_fixed)
+{
+	const size_t step = value_bits / 8;
+	size_t i;
+
+	for (i = 0; i < size_in_bytes; i += step) {
+		void __iomem *addr = (uint8_t __iomem *)base + (is_offset_fixed ? 0 : i);
+		if (value_bits == 64) {
+			writeq_relaxed(*(uint64_t *)(buf + i), addr);
+		} else {
+			writel_relaxed(*(uint32_t *)(buf + i), addr);
+		}
+	}
+}
+
+static void ioreg_read_batch_reference(void __iomem *base, int value_bits, size_t size_in_bytes,
+				       uint8_t *buf, bool is_offset_fixed)
+{
+	const size_t step = value_bits / 8;
+	size_t i;
+
+	for (i = 0; i < size_in_bytes; i += step) {
+		void __iomem *addr = (uint8_t __iomem *)base + (is_offset_fixed ? 0 : i);
+		if (value_bits == 64) {
+			*(uint64_t *)(buf + i) = readq_relaxed(addr);
+		} else {
+			*(uint32_t *)(buf + i) = readl_relaxed(addr);
+		}
+	}
+}
+
+static uint64_t benchmark_mbps(uint64_t bytes, uint64_t elapsed_ns)
+{
+	if (elapsed_ns == 0) {
+		return 0;
+	}
+	/* bytes per ns * 1000 = MB/s */
+	return div64_u64(bytes * 1000, elapsed_ns);
+}
+
+/* Times one register width and addressing mode, and appends a line for it */
+static void ioreg_batch_benchmark_case(uint8_t *block, uint8_t *table, int value_bits,
+				       bool is_offset_fixed, char *buffer, size_t buffer_size)
+{
+	const uint64_t total_bytes = (uint64_t)IOREG_BENCHMARK_TABLE_SIZE * IOREG_BENCHMARK_ITERATIONS;
+	uint64_t ref_write_ns, ref_read_ns, write_ns, read_ns;
+	char tmp_buf[128] = {};
+	ktime_t start;
+	int i;
+
+	start = ktime_get();
+	for (i = 0; i < IOREG_BENCHMARK_ITERATIONS; ++i) {
+		ioreg_write_batch_reference((void __iomem *)block, value_bits,
+					    IOREG_BENCHMARK_TABLE_SIZE, table, is_offset_fixed);
+	}
+	ref_write_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < IOREG_BENCHMARK_ITERATIONS; ++i) {
+		ioreg_write_batch_internal((void __iomem *)block, 0, value_bits,
+					   IOREG_BENCHMARK_TABLE_SIZE, table, is_offset_fixed);
+	}
+	write_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < IOREG_BENCHMARK_ITERATIONS; ++i) {
+		ioreg_read_batch_reference((void __iomem *)block, value_bits,
+					   IOREG_BENCHMARK_TABLE_SIZE, table, is_offset_fixed);
+	}
+	ref_read_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < IOREG_BENCHMARK_ITERATIONS; ++i) {
+		ioreg_read_batch_internal((void __iomem *)block, 0, value_bits,
+					  IOREG_BENCHMARK_TABLE_SIZE, table, is_offset_fixed);
+	}
+	read_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	scnprintf(tmp_buf, sizeof(tmp_buf),
+		  "%d-bit %s: write %llu -> %llu MB/s, read %llu -> %llu MB/s\n", value_bits,
+		  is_offset_fixed ? "fixed" : "incrementing",
+		  benchmark_mbps(total_bytes, ref_write_ns), benchmark_mbps(total_bytes, write_ns),
+		  benchmark_mbps(total_bytes, ref_read_ns), benchmark_mbps(total_bytes, read_ns));
+	strlcat(buffer, tmp_buf, buffer_size);
+}
+
+int lwis_ioreg_batch_benchmark(char *buffer, size_t buffer_size)
+{
+	uint8_t *table;
+	uint8_t *block;
+	int ret = 0;
+
+	table = vmalloc(IOREG_BENCHMARK_TABLE_SIZE);
+	if (!table) {
+		return -ENOMEM;
+	}
+	/* Plain memory stands in for the register block so the numbers measure
+	   the access pattern only, not the bus */
+	block = vmalloc(IOREG_BENCHMARK_TABLE_SIZE);
+	if (!block) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+	memset(table, 0xA5, IOREG_BENCHMARK_TABLE_SIZE);
+
+	scnprintf(buffer, buffer_size,
+		  "Table size: %d bytes x %d, register-at-a-time -> batched\n",
+		  IOREG_BENCHMARK_TABLE_SIZE, IOREG_BENCHMARK_ITERATIONS);
+	/* Incrementing offsets use the unrolled loops, fixed ones the _rep accessors */
+	ioreg_batch_benchmark_case(block, table, 32, /*is_offset_fixed=*/false, buffer,
+				   buffer_size);
+	ioreg_batch_benchmark_case(block, table, 64, /*is_offset_fixed=*/false, buffer,
+				   buffer_size);
+	ioreg_batch_benchmark_case(block, table, 32, /*is_offset_fixed=*/true, buffer,
+				   buffer_size);
+	ioreg_batch_benchmark_case(block, table, 64, /*is_offset_fixed=*/true, buffer,
+				   buffer_size);
+
+	vfree(block);
+exit:
+	vfree(table);
+	return ret;
+}
+#endif
@@ -52,6 +52,16 @@ int lwis_ioreg_put_by_name(struct lwis_ioreg_device *ioreg_dev, char *name);
 int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entry,
 			   int access_size);
 
+/*
+ *  lwis_ioreg_io_entries_rw: Process a run of write-type io_entries, validating
+ *  them all up front and then taking the device lock once per bounded chunk
+ *  rather than once per entry. Processing stops before the first entry that
+ *  does not validate, or after one that fails; *num_processed is set to the
+ *  number of entries handled.
+ */
+int lwis_ioreg_io_entries_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entries,
+			     int num_entries, int access_size, int *num_processed);
+
 /*
  *  lwis_ioreg_read: Read single register.
  */
@@ -70,4 +80,29 @@ int lwis_ioreg_write(struct lwis_ioreg_device *ioreg_dev, int index, uint64_t of
 int lwis_ioreg_set_io_barrier(struct lwis_ioreg_device *ioreg_dev, bool use_read_barrier,
 			      bool use_write_barrier);
 
+/*
+ *  lwis_ioreg_mmap: Map a DT-whitelisted register block read-only and uncached
+ *  into userspace. The block index is given by the page offset of the mapping.
+ *  Only blocks whose start and size are page aligned can be mapped, so no
+ *  neighbouring registers are exposed.
+ */
+int lwis_ioreg_mmap(struct lwis_ioreg_device *ioreg_dev, struct file *fp,
+		    struct vm_area_struct *vma);
+
+/*
+ *  lwis_ioreg_mmap_set_active: Allow or revoke userspace access to mapped
+ *  register blocks, called as the device is enabled and disabled.
+ */
+void lwis_ioreg_mmap_set_active(struct lwis_ioreg_device *ioreg_dev, bool active);
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ *  lwis_ioreg_batch_benchmark: Times a large table upload and readback through
+ *  the batch accessors against a register-at-a-time loop, and prints the
+ *  throughput of each into buffer. Covers 32 and 64-bit registers, at both
+ *  incrementing and fixed offsets.
+ */
+int lwis_ioreg_batch_benchmark(char *buffer, size_t buffer_size);
+#endif
+
 #endif /* LWIS_IOREG_H_ */
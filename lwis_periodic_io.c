@@ -33,6 +33,7 @@ static enum hrtimer_restart periodic_io_timer_func(struct hrtimer *timer)
 	struct lwis_periodic_io_proxy *periodic_io_proxy;
 	struct lwis_client *client;
 	bool active_periodic_io_present = false;
+	enum hrtimer_restart restart = HRTIMER_NORESTART;
 
 	periodic_io_list = container_of(timer, struct lwis_periodic_io_list, hr_timer);
 	client = periodic_io_list->client;
@@ -58,25 +59,29 @@ static enum hrtimer_restart periodic_io_timer_func(struct hrtimer *timer)
 	if (active_periodic_io_present) {
 		kthread_queue_work(&client->lwis_dev->periodic_io_worker,
 				   &client->periodic_io_work);
-	}
-	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
-	if (!active_periodic_io_present) {
+		/* A trigger event may have re-phased and requeued this timer
+		 * while we were waiting on the lock, keep that expiry instead */
+		if (!hrtimer_is_queued(timer)) {
+			interval = ktime_set(0, periodic_io_list->period_ns);
+			hrtimer_forward_now(timer, interval);
+			restart = HRTIMER_RESTART;
+		}
+	} else {
 		periodic_io_list->hr_timer_state = LWIS_HRTIMER_INACTIVE;
-		return HRTIMER_NORESTART;
 	}
+	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
 
-	interval = ktime_set(0, periodic_io_list->period_ns);
-	hrtimer_forward_now(timer, interval);
-
-	return HRTIMER_RESTART;
+	return restart;
 }
 
 static struct lwis_periodic_io_list *periodic_io_list_find(struct lwis_client *client,
-							   int64_t period_ns)
+							   struct lwis_periodic_io *periodic_io)
 {
 	struct lwis_periodic_io_list *list;
-	hash_for_each_possible (client->timer_list, list, node, period_ns) {
-		if (list->period_ns == period_ns) {
+	hash_for_each_possible (client->timer_list, list, node, periodic_io->info.period_ns) {
+		if (list->period_ns == periodic_io->info.period_ns &&
+		    list->trigger_event_id == periodic_io->trigger_event_id &&
+		    list->trigger_offset_ns == periodic_io->trigger_offset_ns) {
 			return list;
 		}
 	}
@@ -84,9 +89,10 @@ static struct lwis_periodic_io_list *periodic_io_list_find(struct lwis_client *c
 }
 
 /* Calling this function requires holding the client's periodic_io_lock */
-static struct lwis_periodic_io_list *periodic_io_list_create_locked(struct lwis_client *client,
-								    int64_t period_ns)
+static struct lwis_periodic_io_list *
+periodic_io_list_create_locked(struct lwis_client *client, struct lwis_periodic_io *periodic_io)
 {
+	struct lwis_periodic_io_info *info = &periodic_io->info;
 	ktime_t ktime;
 	struct lwis_periodic_io_list *periodic_io_list =
 		kmalloc(sizeof(struct lwis_periodic_io_list), GFP_ATOMIC);
@@ -96,14 +102,32 @@ static struct lwis_periodic_io_list *periodic_io_list_create_locked(struct lwis_
 	}
 
 	periodic_io_list->client = client;
-	periodic_io_list->period_ns = period_ns;
-	periodic_io_list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
+	periodic_io_list->period_ns = info->period_ns;
+	periodic_io_list->trigger_event_id = periodic_io->trigger_event_id;
+	periodic_io_list->trigger_offset_ns = periodic_io->trigger_offset_ns;
 
 	/* Initialize the periodic io list and add this timer/periodic_io_list
 	 * into the client timer list */
 	INIT_LIST_HEAD(&periodic_io_list->list);
-	hash_add(client->timer_list, &periodic_io_list->node, period_ns);
-	pr_info("Created hrtimer with timeout time %lldns", period_ns);
+	INIT_LIST_HEAD(&periodic_io_list->anchored_node);
+	hash_add(client->timer_list, &periodic_io_list->node, info->period_ns);
+
+	if (periodic_io->trigger_event_id != LWIS_EVENT_ID_NONE) {
+		/* Anchored timers expire at absolute times derived from the
+		 * trigger event timestamp, which is in CLOCK_BOOTTIME. The
+		 * timer is not started until the first trigger event. */
+		periodic_io_list->hr_timer_state = LWIS_HRTIMER_INACTIVE;
+		list_add_tail(&periodic_io_list->anchored_node, &client->anchored_timer_list);
+		hrtimer_init(&periodic_io_list->hr_timer, CLOCK_BOOTTIME, HRTIMER_MODE_ABS);
+		periodic_io_list->hr_timer.function = &periodic_io_timer_func;
+		pr_info("Created hrtimer with timeout time %lldns anchored to event 0x%llx + %lldns",
+			info->period_ns, periodic_io->trigger_event_id,
+			periodic_io->trigger_offset_ns);
+		return periodic_io_list;
+	}
+
+	periodic_io_list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
+	pr_info("Created hrtimer with timeout time %lldns", info->period_ns);
 
 	/* Initialize and start the hrtimer for this periodic io list */
 	hrtimer_init(&periodic_io_list->hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
@@ -116,17 +140,20 @@ static struct lwis_periodic_io_list *periodic_io_list_create_locked(struct lwis_
 
 /* Calling this function requires holding the client's periodic_io_lock */
 static struct lwis_periodic_io_list *
-periodic_io_list_find_or_create_locked(struct lwis_client *client, int64_t period_ns)
+periodic_io_list_find_or_create_locked(struct lwis_client *client,
+				       struct lwis_periodic_io *periodic_io)
 {
-	struct lwis_periodic_io_list *list = periodic_io_list_find(client, period_ns);
+	struct lwis_periodic_io_list *list = periodic_io_list_find(client, periodic_io);
 
 	if (list == NULL) {
-		return periodic_io_list_create_locked(client, period_ns);
+		return periodic_io_list_create_locked(client, periodic_io);
 	}
 
 	/* If there is already a timer with the same period and it is inactive,
-	 * then restart the timer */
-	if (list->hr_timer_state == LWIS_HRTIMER_INACTIVE) {
+	 * then restart the timer. Anchored timers are restarted by their
+	 * trigger event instead. */
+	if (list->hr_timer_state == LWIS_HRTIMER_INACTIVE &&
+	    list->trigger_event_id == LWIS_EVENT_ID_NONE) {
 		list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
 		/* If this does not restart the hrtimer properly, consider
 		 * repeating the steps when starting a new timer. */
@@ -232,7 +259,8 @@ static int process_io_entries(struct lwis_client *client,
 			}
 			read_buf += sizeof(struct lwis_periodic_io_result) +
 				    io_result->io_result.num_value_bytes;
-		} else if (entry->type == LWIS_IO_ENTRY_POLL) {
+		} else if (entry->type == LWIS_IO_ENTRY_POLL ||
+			   entry->type == LWIS_IO_ENTRY_POLL_US) {
 			ret = lwis_io_entry_poll(lwis_dev, entry, /*non_blocking=*/false);
 			if (ret) {
 				resp->error_code = ret;
@@ -407,11 +435,8 @@ static int prepare_response(struct lwis_client *client, struct lwis_periodic_io
 static int queue_periodic_io_locked(struct lwis_client *client,
 				    struct lwis_periodic_io *periodic_io)
 {
-	int64_t period_ns;
 	struct lwis_periodic_io_list *periodic_io_list;
-	struct lwis_periodic_io_info *info = &periodic_io->info;
-	period_ns = info->period_ns;
-	periodic_io_list = periodic_io_list_find_or_create_locked(client, period_ns);
+	periodic_io_list = periodic_io_list_find_or_create_locked(client, periodic_io);
 	if (!periodic_io_list) {
 		pr_err_ratelimited("Cannot create timer/periodic io list\n");
 		kfree(periodic_io->resp);
@@ -448,6 +473,7 @@ int lwis_periodic_io_init(struct lwis_client *client)
 	kthread_init_work(&client->periodic_io_work, periodic_io_work_func);
 	client->periodic_io_counter = 0;
 	hash_init(client->timer_list);
+	INIT_LIST_HEAD(&client->anchored_timer_list);
 	return 0;
 }
 
@@ -458,6 +484,21 @@ int lwis_periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io
 	unsigned long flags;
 	struct lwis_periodic_io_info *info = &periodic_io->info;
 
+	if (periodic_io->trigger_event_id != LWIS_EVENT_ID_NONE) {
+		if (periodic_io->trigger_offset_ns < 0) {
+			pr_err_ratelimited("Invalid trigger offset %lldns\n",
+					   periodic_io->trigger_offset_ns);
+			return -EINVAL;
+		}
+		/* The trigger event may not have been enabled or emitted yet */
+		if (IS_ERR_OR_NULL(lwis_device_event_state_find_or_create(
+			    client->lwis_dev, periodic_io->trigger_event_id))) {
+			pr_err_ratelimited("Cannot create trigger event 0x%llx for periodic io\n",
+					   periodic_io->trigger_event_id);
+			return -EINVAL;
+		}
+	}
+
 	periodic_io->contains_multiple_writes = false;
 	for (i = 0; i < info->num_io_entries; ++i) {
 		struct lwis_io_entry *entry = &info->io_entries[i];
@@ -546,12 +587,49 @@ int lwis_periodic_io_client_cleanup(struct lwis_client *client)
 
 	spin_lock_irqsave(&client->periodic_io_lock, flags);
 	hash_for_each_safe (client->timer_list, i, tmp, it_periodic_io_list, node) {
+		list_del(&it_periodic_io_list->anchored_node);
 		hash_del(&it_periodic_io_list->node);
 	}
 	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
 	return 0;
 }
 
+void lwis_periodic_io_event_trigger(struct lwis_client *client, int64_t event_id,
+				    int64_t timestamp)
+{
+	unsigned long flags;
+	struct lwis_periodic_io_list *periodic_io_list;
+	struct lwis_periodic_io *periodic_io;
+	bool active_periodic_io_present;
+
+	spin_lock_irqsave(&client->periodic_io_lock, flags);
+	list_for_each_entry (periodic_io_list, &client->anchored_timer_list, anchored_node) {
+		if (periodic_io_list->trigger_event_id != event_id) {
+			continue;
+		}
+
+		/* Do not bring back a timer whose periodic ios are all done */
+		active_periodic_io_present = false;
+		list_for_each_entry (periodic_io, &periodic_io_list->list, timer_list_node) {
+			if (periodic_io->active) {
+				active_periodic_io_present = true;
+				break;
+			}
+		}
+		if (!active_periodic_io_present) {
+			continue;
+		}
+
+		/* Restarting a queued hrtimer replaces its expiry, which drops
+		 * the remaining periods of the previous frame */
+		periodic_io_list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
+		hrtimer_start(&periodic_io_list->hr_timer,
+			      ns_to_ktime(timestamp + periodic_io_list->trigger_offset_ns),
+			      HRTIMER_MODE_ABS);
+	}
+	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
+}
+
 /* Calling this function requires holding the client's periodic_io_lock */
 static int mark_periodic_io_resp_error_locked(struct lwis_periodic_io *periodic_io)
 {
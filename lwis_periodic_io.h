@@ -29,6 +29,10 @@ enum lwis_hrtimer_state {
 // periodic io is skipped when the timer worker func is processing workload.
 struct lwis_periodic_io {
 	struct lwis_periodic_io_info info;
+	/* Event that re-phases the timer, LWIS_EVENT_ID_NONE if free-running */
+	int64_t trigger_event_id;
+	/* Delay of the first expiry after each trigger event, in nanosecond */
+	int64_t trigger_offset_ns;
 	struct lwis_periodic_io_response_header *resp;
 	/* Counter of the execution times within a batch. Reset to 0 after a
 	 * batch is done */
@@ -66,6 +70,12 @@ struct lwis_periodic_io_list {
 	struct hrtimer hr_timer;
 	/* Time out time in nanosecond */
 	int64_t period_ns;
+	/* Event that re-phases this timer, LWIS_EVENT_ID_NONE if free-running */
+	int64_t trigger_event_id;
+	/* Delay of the first expiry after each trigger event, in nanosecond */
+	int64_t trigger_offset_ns;
+	/* Node in the anchored timer list held by the LWIS client */
+	struct list_head anchored_node;
 	/* State of the timer */
 	enum lwis_hrtimer_state hr_timer_state;
 	/* LWIS client this timer/periodic_io_list belongs to */
@@ -83,4 +93,16 @@ int lwis_periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io
 int lwis_periodic_io_cancel(struct lwis_client *client, int64_t id);
 void lwis_periodic_io_free(struct lwis_device *lwis_dev, struct lwis_periodic_io *periodic_io);
 
+/*
+ * lwis_periodic_io_event_trigger: Re-phases the client's periodic io timers
+ * that are anchored to event_id, so that they expire trigger_offset_ns after
+ * the event timestamp and every period_ns afterwards.
+ *
+ * Locks: client->periodic_io_lock
+ * Alloc: No
+ * Returns: void
+ */
+void lwis_periodic_io_event_trigger(struct lwis_client *client, int64_t event_id,
+				    int64_t timestamp);
+
 #endif /* LWIS_PERIODIC_IO_H_ */
\ No newline at end of file
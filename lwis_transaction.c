@@ -102,6 +102,7 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 {
 	int i;
 	int ret = 0;
+	int run_length;
 	struct lwis_io_entry *entry = NULL;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 	struct lwis_transaction_info *info = &transaction->info;
@@ -128,6 +129,33 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 
 	for (i = 0; i < info->num_io_entries; ++i) {
 		entry = &info->io_entries[i];
+		if (entry->type == LWIS_IO_ENTRY_WRITE ||
+		    entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
+		    entry->type == LWIS_IO_ENTRY_MODIFY) {
+			/* Let the device write the whole run of writes at once */
+			ret = lwis_io_entry_write_run(lwis_dev, entry, info->num_io_entries - i,
+						      in_irq, &run_length);
+			if (ret) {
+				resp->error_code = ret;
+				/* The entries of the run before the failed one were written */
+				if (run_length > 1) {
+					resp->completion_index = i + run_length - 2;
+				}
+				if (skip_err) {
+					dev_warn(lwis_dev->dev,
+						 "transaction type %d processing failed, skip this error and run the next command\n",
+						 entry->type);
+					i += max(run_length, 1) - 1;
+					continue;
+				}
+				break;
+			}
+			if (run_length > 0) {
+				i += run_length - 1;
+				resp->completion_index = i;
+				continue;
+			}
+		}
 		if (entry->type == LWIS_IO_ENTRY_WRITE ||
 		    entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
 		    entry->type == LWIS_IO_ENTRY_MODIFY) {
@@ -181,7 +209,8 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 				break;
 			}
 			read_buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
-		} else if (entry->type == LWIS_IO_ENTRY_POLL) {
+		} else if (entry->type == LWIS_IO_ENTRY_POLL ||
+			   entry->type == LWIS_IO_ENTRY_POLL_US) {
 			ret = lwis_io_entry_poll(lwis_dev, entry, in_irq);
 			if (ret) {
 				resp->error_code = ret;
@@ -10,6 +10,7 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME "-util: " fmt
 
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <uapi/linux/sched/types.h>
 #include "lwis_util.h"
@@ -125,6 +126,16 @@ int lwis_create_kthread_workers(struct lwis_device *lwis_dev)
 		return -EINVAL;
 	}
 
+	/* Workers float unless the device tree pins them, a failure keeps them floating */
+	if (lwis_dev->transaction_thread_cpu_mask != 0) {
+		lwis_set_kthread_affinity(lwis_dev, lwis_dev->transaction_worker_thread,
+					  lwis_dev->transaction_thread_cpu_mask);
+	}
+	if (lwis_dev->periodic_io_thread_cpu_mask != 0) {
+		lwis_set_kthread_affinity(lwis_dev, lwis_dev->periodic_io_worker_thread,
+					  lwis_dev->periodic_io_thread_cpu_mask);
+	}
+
 	return 0;
 }
 
@@ -157,4 +168,49 @@ int lwis_set_kthread_priority(struct lwis_device *lwis_dev, struct task_struct *
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+void lwis_cpumask_from_u64(struct cpumask *dst, uint64_t cpu_mask)
+{
+	int cpu;
+
+	cpumask_clear(dst);
+	for (cpu = 0; cpu < min_t(int, nr_cpu_ids, BITS_PER_TYPE(uint64_t)); cpu++) {
+		if (cpu_mask & (1ULL << cpu)) {
+			cpumask_set_cpu(cpu, dst);
+		}
+	}
+}
+
+uint64_t lwis_cpumask_to_u64(const struct cpumask *src)
+{
+	int cpu;
+	uint64_t cpu_mask = 0;
+
+	for_each_cpu (cpu, src) {
+		if (cpu >= BITS_PER_TYPE(uint64_t)) {
+			break;
+		}
+		cpu_mask |= (1ULL << cpu);
+	}
+	return cpu_mask;
+}
+
+int lwis_set_kthread_affinity(struct lwis_device *lwis_dev, struct task_struct *task,
+			      uint64_t cpu_mask)
+{
+	cpumask_var_t cpus;
+	int ret;
+
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+		return -ENOMEM;
+	}
+	lwis_cpumask_from_u64(cpus, cpu_mask);
+	ret = set_cpus_allowed_ptr(task, cpus);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to set kthread affinity to 0x%llx (%d)", cpu_mask,
+			ret);
+	}
+	free_cpumask_var(cpus);
+	return ret;
+}
@@ -11,6 +11,7 @@
 #ifndef LWIS_UTIL_H_
 #define LWIS_UTIL_H_
 
+#include <linux/cpumask.h>
 #include <linux/kernel.h>
 #include <linux/ktime.h>
 
@@ -75,4 +76,22 @@ int lwis_create_kthread_workers(struct lwis_device *lwis_dev);
 int lwis_set_kthread_priority(struct lwis_device *lwis_dev, struct task_struct *task,
 			      u32 priority);
 
+/*
+ * lwis_cpumask_from_u64: Fills a cpumask from a mask with one bit per CPU.
+ */
+void lwis_cpumask_from_u64(struct cpumask *dst, uint64_t cpu_mask);
+
+/*
+ * lwis_cpumask_to_u64: Returns a cpumask as a mask with one bit per CPU,
+ * CPUs past the 64th are left out.
+ */
+uint64_t lwis_cpumask_to_u64(const struct cpumask *src);
+
+/*
+ * lwis_set_kthread_affinity: Restricts a kthread to the CPUs in cpu_mask, one
+ * bit per CPU.
+ */
+int lwis_set_kthread_affinity(struct lwis_device *lwis_dev, struct task_struct *task,
+			      uint64_t cpu_mask);
+
 #endif // LWIS_UTIL_H_